@@ -0,0 +1,129 @@
+#ifndef HUEBLOB_BLOB_STATISTICS_HH
+# define HUEBLOB_BLOB_STATISTICS_HH
+# include <algorithm>
+# include <cstddef>
+# include <vector>
+# include <opencv2/core/core.hpp>
+
+class DepthFilter;
+class EllipseMask;
+class Reprojector;
+
+/// \brief Blob 3d statistics computed without a cloud.
+///
+/// Points are not stored: each one is accumulated, as it is
+/// reprojected, into a fixed depth bin holding the count, sum and
+/// bounds of its points. compute then runs the configured DepthFilter
+/// on the bins, and sums the bins whose mean depth is kept into the
+/// centroid and bounds.
+///
+/// Bins are 1 / bins_per_meter deep, points beyond max_bins bins share
+/// the last one. Results are those of the filtered cloud, except for
+/// points within a bin of the interval bounds, which are kept or
+/// rejected with their bin.
+///
+/// Only the linear time filters can run here: STATISTICAL_FILTER (PCL
+/// SOR) needs the cloud, HISTOGRAM_FILTER is used instead, see
+/// compute.
+class BlobStatistics
+{
+public:
+  /// \brief Depth resolution.
+  static const std::size_t bins_per_meter = 500;
+  /// \brief Number of depth bins, from the camera.
+  static const std::size_t max_bins = 4096;
+
+  explicit BlobStatistics();
+
+  /// \brief Start a new blob.
+  void reset();
+
+  /// \brief Add a point, z must be a valid reprojected depth.
+  void add(float x, float y, float z);
+
+  /// \brief Reproject a region and add its valid pixels.
+  ///
+  /// \param reprojector reprojector set up for the disparity image.
+  /// \param disparity CV_32FC1 disparity image.
+  /// \param rect region of the blob.
+  /// \param mask if not empty, CV_8UC1 image of the size of rect:
+  ///        only pixels with a non zero mask are added.
+  void add(Reprojector& reprojector, const cv::Mat& disparity,
+	   const cv::Rect& rect, const cv::Mat& mask = cv::Mat());
+
+  /// \brief Reproject the pixels of an ellipse mask.
+  ///
+  /// Only the spans of the mask are reprojected.
+  void add(Reprojector& reprojector, const cv::Mat& disparity,
+	   const EllipseMask& mask);
+
+  /// \brief Reject outliers and compute the blob statistics.
+  ///
+  /// \param filter MAD_FILTER or HISTOGRAM_FILTER settings, see
+  ///        DepthFilter::depthRange. STATISTICAL_FILTER falls back to
+  ///        HISTOGRAM_FILTER with the same settings: callers needing
+  ///        SOR itself must build the cloud instead.
+  /// \return false if no point is left.
+  bool compute(DepthFilter& filter);
+
+  /// \brief Number of points added since reset.
+  std::size_t points() const;
+
+  /// \name Results of compute
+  /// \{
+  /// \brief Points kept.
+  std::size_t inliers_;
+  cv::Point3f centroid_;
+  cv::Point3f min_;
+  cv::Point3f max_;
+  /// \}
+
+private:
+  /// \brief Points of a depth bin.
+  struct Bin
+  {
+    unsigned count;
+    cv::Point3d sum;
+    cv::Point3f min;
+    cv::Point3f max;
+  };
+
+  std::size_t added_;
+  /// \brief max_bins bins, allocated once.
+  std::vector<Bin> bins_;
+  /// \brief Bins added to since reset are in [first_, last_].
+  std::size_t first_;
+  std::size_t last_;
+  /// \name Non empty bins, for DepthFilter::depthRange
+  /// \{
+  std::vector<float> depths_;
+  std::vector<unsigned> counts_;
+  /// \}
+};
+
+inline void
+BlobStatistics::add(float x, float y, float z)
+{
+  const std::size_t index =
+    std::min(std::size_t(std::max(z, 0.f) * bins_per_meter), max_bins - 1);
+  Bin& bin = bins_[index];
+  const cv::Point3f p(x, y, z);
+  if (!bin.count)
+    {
+      bin.sum = cv::Point3d(0., 0., 0.);
+      bin.min = bin.max = p;
+      first_ = std::min(first_, index);
+      last_ = std::max(last_, index);
+    }
+  ++bin.count;
+  bin.sum += cv::Point3d(x, y, z);
+  bin.min.x = std::min(bin.min.x, x);
+  bin.min.y = std::min(bin.min.y, y);
+  bin.min.z = std::min(bin.min.z, z);
+  bin.max.x = std::max(bin.max.x, x);
+  bin.max.y = std::max(bin.max.y, y);
+  bin.max.z = std::max(bin.max.z, z);
+  ++added_;
+}
+
+#endif //! HUEBLOB_BLOB_STATISTICS_HH
@@ -0,0 +1,122 @@
+#ifndef HUEBLOB_DEPTH_FILTER_HH
+# define HUEBLOB_DEPTH_FILTER_HH
+# include <cstddef>
+# include <string>
+# include <vector>
+
+/// \brief Outlier rejection applied to blob clouds.
+///
+/// STATISTICAL_FILTER is PCL StatisticalOutlierRemoval, run by the
+/// caller: a k nearest neighbors query per point. MAD_FILTER and
+/// HISTOGRAM_FILTER only look at depths and run in linear time, see
+/// DepthFilter.
+typedef enum{
+  STATISTICAL_FILTER = 0,
+  MAD_FILTER = 1,
+  HISTOGRAM_FILTER = 2,
+} depth_filter_t;
+
+/// \brief Convert a depth filter parameter value into a depth_filter_t.
+///
+/// Accepts "statistical", "mad" and "histogram".
+depth_filter_t parseDepthFilter(const std::string& filter);
+
+/// \brief Linear time depth outlier rejection.
+///
+/// A blob is mostly made of points at the object depth, outliers come
+/// from the background and from stereo mismatches along the object
+/// borders. Both methods keep the points whose depth lies in an
+/// interval around the dominant depth:
+///
+/// - MAD_FILTER: median +/- madScale times the scaled median absolute
+///   deviation, at least +/- minSpread.
+/// - HISTOGRAM_FILTER: the depths are binned every binSize meters, the
+///   interval is centered on the mode (summed over three bins) and
+///   spans +/- gateWidth.
+///
+/// Scratch buffers are kept from one call to the next.
+class DepthFilter
+{
+public:
+  explicit DepthFilter();
+
+  /// \brief Remove the outliers, keeping the points order.
+  ///
+  /// Points is a container of points with a z member, e.g. the points
+  /// of a PCL cloud. Nothing is done for STATISTICAL_FILTER.
+  ///
+  /// \return number of points kept.
+  template <typename Points>
+  std::size_t filter(Points& points);
+
+  /// \brief Compute the interval of depths kept among depths.
+  ///
+  /// \return false if there is no depth.
+  bool depthRange(float& low, float& high);
+
+  /// \brief Compute the interval of depths kept among binned depths.
+  ///
+  /// Same as depthRange, up to the bins resolution: bin i holds
+  /// counts[i] points of mean depth depths[i], bins being sorted by
+  /// depth and not empty. Used when the points are not stored, see
+  /// BlobStatistics: SOR cannot run then, STATISTICAL_FILTER computes
+  /// the HISTOGRAM_FILTER interval.
+  ///
+  /// \return false if there is no depth.
+  bool depthRange(const std::vector<float>& depths,
+		  const std::vector<unsigned>& counts,
+		  float& low, float& high);
+
+  depth_filter_t method_;
+  /// \name MAD_FILTER settings, in MADs and meters.
+  /// \{
+  double madScale_;
+  double minSpread_;
+  /// \}
+  /// \name HISTOGRAM_FILTER settings, in meters.
+  /// \{
+  double binSize_;
+  double gateWidth_;
+  /// \}
+
+  /// \brief Depths of the filtered points, reordered by depthRange.
+  std::vector<float> depths_;
+
+private:
+  /// \brief Clear histogram_ for depths in [minDepth, maxDepth].
+  ///
+  /// \return bin size, binSize_ unless there would be too many bins.
+  double resetHistogram(float minDepth, float maxDepth);
+  /// \brief HISTOGRAM_FILTER interval of the depths in histogram_.
+  void modeRange(float minDepth, double bin, float& low, float& high) const;
+
+  std::vector<unsigned> histogram_;
+};
+
+template <typename Points>
+std::size_t
+DepthFilter::filter(Points& points)
+{
+  if (method_ == STATISTICAL_FILTER)
+    return points.size();
+
+  depths_.resize(points.size());
+  for (std::size_t i = 0; i < points.size(); ++i)
+    depths_[i] = points[i].z;
+  float low, high;
+  if (!depthRange(low, high))
+    return 0;
+
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < points.size(); ++i)
+    if (points[i].z >= low && points[i].z <= high)
+      {
+	if (kept != i)
+	  points[kept] = points[i];
+	++kept;
+      }
+  points.resize(kept);
+  return kept;
+}
+
+#endif //! HUEBLOB_DEPTH_FILTER_HH
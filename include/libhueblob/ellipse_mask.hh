@@ -0,0 +1,64 @@
+#ifndef HUEBLOB_ELLIPSE_MASK_HH
+# define HUEBLOB_ELLIPSE_MASK_HH
+# include <cstddef>
+# include <vector>
+# include <opencv2/core/core.hpp>
+
+/// \brief Blob mask described by the tracked ellipse.
+///
+/// The ellipse inscribed in a rotated rect is convex, so its pixels
+/// in each row of the blob region form a single span. The spans are
+/// solved analytically from the rotated rect parameters, which is all
+/// a consumer needs instead of a rasterized mask image.
+///
+/// Rows and columns are relative to the blob region.
+class EllipseMask
+{
+public:
+  explicit EllipseMask();
+
+  /// \brief Compute the spans of the ellipse inscribed in rrect.
+  ///
+  /// \param rrect tracked rotated rect, in image coordinates.
+  /// \param rect blob region, in image coordinates.
+  void set(const cv::RotatedRect& rrect, const cv::Rect& rect);
+
+  /// \brief Blob region given to set.
+  const cv::Rect& rect() const;
+
+  /// \brief First column of a row span.
+  int begin(int row) const;
+  /// \brief Column after the last one of a row span, begin if empty.
+  int end(int row) const;
+  /// \brief Is a pixel inside the ellipse?
+  bool contains(int row, int column) const;
+
+  /// \brief Number of pixels inside the ellipse.
+  std::size_t area() const;
+
+private:
+  cv::Rect rect_;
+  std::vector<int> begins_;
+  std::vector<int> ends_;
+  std::size_t area_;
+};
+
+inline int
+EllipseMask::begin(int row) const
+{
+  return begins_[row];
+}
+
+inline int
+EllipseMask::end(int row) const
+{
+  return ends_[row];
+}
+
+inline bool
+EllipseMask::contains(int row, int column) const
+{
+  return column >= begins_[row] && column < ends_[row];
+}
+
+#endif //! HUEBLOB_ELLIPSE_MASK_HH
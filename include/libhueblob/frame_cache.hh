@@ -0,0 +1,54 @@
+#ifndef HUEBLOB_FRAME_CACHE_HH
+# define HUEBLOB_FRAME_CACHE_HH
+# include <map>
+# include <string>
+# include <boost/cstdint.hpp>
+# include <boost/noncopyable.hpp>
+# include <boost/shared_ptr.hpp>
+# include <boost/thread/mutex.hpp>
+# include <opencv2/core/core.hpp>
+
+/// \brief Per-frame preprocessing shared by all the tracked objects.
+///
+/// Each camera image is converted to HSV at most once per frame,
+/// whatever the number of objects tracked in it. Entries are keyed on
+/// the camera name and the image stamp, their buffers are reused from
+/// one frame to the next.
+///
+/// Only objects reading the whole frame should use it, see
+/// Object::readsAreaHsv: converting the frame for an object limited to
+/// a region would cancel the region savings.
+class FrameCache : private boost::noncopyable
+{
+public:
+  explicit FrameCache();
+
+  /// \brief Get the HSV version of a camera image.
+  ///
+  /// The image is only converted the first time it is requested for
+  /// a given stamp. The returned image is valid until a newer frame of
+  /// the same camera is requested.
+  ///
+  /// \param camera camera name, e.g. "left"
+  /// \param stamp image stamp, in nanoseconds
+  /// \param image BGR image
+  cv::Mat hsv(const std::string& camera, boost::uint64_t stamp,
+	      const cv::Mat& image);
+
+private:
+  struct Entry
+  {
+    Entry() : stamp(), valid(false), hsv(), mutex() {}
+    boost::uint64_t stamp;
+    bool valid;
+    cv::Mat hsv;
+    boost::mutex mutex;
+  };
+
+  /// \brief One entry per camera.
+  std::map<std::string, boost::shared_ptr<Entry> > entries_;
+  /// \brief Protect entries, not their content.
+  boost::mutex mutex_;
+};
+
+#endif //! HUEBLOB_FRAME_CACHE_HH
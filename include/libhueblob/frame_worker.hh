@@ -0,0 +1,57 @@
+#ifndef HUEBLOB_FRAME_WORKER_HH
+# define HUEBLOB_FRAME_WORKER_HH
+# include <cstddef>
+# include <boost/function.hpp>
+# include <boost/noncopyable.hpp>
+# include <boost/thread/condition_variable.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/thread.hpp>
+
+/// \brief Dedicated thread processing the newest frame only.
+///
+/// Subscriber callbacks post one job per frame and return at once.
+/// The worker runs the jobs one at a time; a job posted while another
+/// one is waiting replaces it, the replaced frame is dropped. When
+/// processing is slower than the frame rate, results therefore stay
+/// one frame old at most instead of lagging behind a subscriber queue.
+///
+/// Unlike Mailbox, the consumer is the worker thread, which sleeps
+/// until a job is posted.
+class FrameWorker : private boost::noncopyable
+{
+public:
+  typedef boost::function<void ()> job_t;
+
+  /// \brief Start the worker thread.
+  explicit FrameWorker();
+  /// \brief Wait for the running job and drop the pending one.
+  ~FrameWorker();
+
+  /// \brief Post a frame job, replacing the pending one if any.
+  void post(const job_t& job);
+
+  /// \name Counters, since construction.
+  /// \{
+  /// \brief Jobs run, including the failed ones.
+  std::size_t processed() const;
+  /// \brief Jobs replaced before they could run.
+  std::size_t dropped() const;
+  /// \brief Jobs which have thrown an exception.
+  std::size_t failed() const;
+  /// \}
+
+private:
+  /// \brief Worker thread main loop.
+  void work();
+
+  mutable boost::mutex mutex_;
+  boost::condition_variable ready_;
+  job_t job_;
+  bool stop_;
+  std::size_t processed_;
+  std::size_t dropped_;
+  std::size_t failed_;
+  boost::thread thread_;
+};
+
+#endif //! HUEBLOB_FRAME_WORKER_HH
@@ -2,14 +2,19 @@
 # define HUEBLOB_HUEBLOB_H
 # include <map>
 # include <string>
+# include <vector>
 
 # include <boost/noncopyable.hpp>
+# include <boost/optional.hpp>
+# include <boost/scoped_ptr.hpp>
+# include <boost/shared_ptr.hpp>
 # include <opencv2/core/core.hpp>
 
 # include <ros/ros.h>
 
 // OpenCV bridge (OpenCV<->ROS conversion).
 # include <cv_bridge/CvBridge.h>
+# include <cv_bridge/cv_bridge.h>
 
 // Image transport.
 # include <image_transport/image_transport.h>
@@ -34,7 +39,17 @@
 # include "hueblob/TrackObject.h"
 
 
+# include "libhueblob/blob_statistics.hh"
+# include "libhueblob/depth_filter.hh"
+# include "libhueblob/frame_cache.hh"
+# include "libhueblob/frame_worker.hh"
+# include "libhueblob/label_engine.hh"
+# include "libhueblob/latency_monitor.hh"
 # include "libhueblob/object.hh"
+# include "libhueblob/object_registry.hh"
+# include "libhueblob/pipeline.hh"
+# include "libhueblob/reprojector.hh"
+# include "libhueblob/worker_pool.hh"
 
 # include <map>
 
@@ -71,7 +86,9 @@ protected:
   /// \brief Image callback.
   ///
   /// Called when a synchronized triplet (left, right, disparity)
-  /// has been received.
+  /// has been received. The frame is processed at once, handed to the
+  /// frame worker if ~latest_frame is set, or pushed to the pipeline if
+  /// ~pipeline is set.
   void imageCallback(const sensor_msgs::ImageConstPtr& left,
 		     const sensor_msgs::CameraInfoConstPtr& left_camera,
 		     const sensor_msgs::ImageConstPtr& right,
@@ -105,7 +122,108 @@ protected:
 
   void checkInputsSynchronized();
 
-  hueblob::Blob trackBlob(const std::string&);
+  struct Frame;
+  typedef boost::shared_ptr<Frame> frame_t;
+
+  /// \brief Run all the stages on a frame.
+  void processFrame(frame_t frame);
+
+  /// \name Frame stages.
+  ///
+  /// Each stage only keeps its own state from one frame to the next,
+  /// so that successive frames may be in different stages at the same
+  /// time (see ~pipeline).
+  /// \{
+
+  /// \brief Convert the images once for all the objects.
+  void convertFrame(frame_t& frame);
+  /// \brief Label the frame and track the objects in both images.
+  ///
+  /// Likelihood and CamShift stay in one stage: the likelihood of a
+  /// frame is computed around the window CamShift found in the
+  /// previous one (roi_gating), and both work in the object buffers.
+  /// As separate stages, the likelihood of frame n + 1 would wait for
+  /// the CamShift of frame n anyway. Objects and cameras run in
+  /// parallel within the stage instead (~threads).
+  void trackFrame(frame_t& frame);
+  /// \brief Compute the 3d blobs.
+  void projectFrame(frame_t& frame);
+  /// \brief Publish the blobs.
+  void publishFrame(frame_t& frame);
+  /// \}
+
+  /// \brief Log the frame worker counters.
+  void reportFrames();
+
+  /// \brief Publish the stage latencies.
+  void publishLatency();
+
+  /// \brief Tracking state of one object for the current frame.
+  struct BlobTrack
+  {
+    BlobTrack(const std::string& name, const ObjectRegistry::model_t& model,
+	      Object* left, Object* right);
+
+    std::string name;
+    /// \brief Object definition, kept alive until the frame is published.
+    ObjectRegistry::model_t model;
+    /// \brief Tracking state, only valid in the tracking stage.
+    Object* left;
+    Object* right;
+    boost::optional<cv::RotatedRect> left_rrect;
+    boost::optional<cv::RotatedRect> right_rrect;
+    hueblob::Blob blob;
+  };
+
+  /// \brief Synchronized inputs and results of a frame.
+  struct Frame
+  {
+    sensor_msgs::ImageConstPtr left;
+    sensor_msgs::CameraInfoConstPtr leftCamera;
+    sensor_msgs::ImageConstPtr right;
+    stereo_msgs::DisparityImageConstPtr disparity;
+    /// \brief Images converted once for all the objects.
+    cv_bridge::CvImageConstPtr leftBgr;
+    cv_bridge::CvImageConstPtr rightBgr;
+    /// \brief Objects tracked in this frame.
+    ObjectRegistry::snapshot_t objects;
+    std::vector<BlobTrack> tracks;
+  };
+
+  /// \brief Projection state of an object, see projectFrame.
+  struct ProjectionState;
+
+  /// \brief Track an object in the left then in the right image.
+  ///
+  /// Tasks for different objects may run concurrently. When the
+  /// epipolar constraint is enabled, the right image is only searched
+  /// in epipolarArea, and not at all if the left tracking failed.
+  void trackStereo(const Frame& frame, BlobTrack& track);
+
+  /// \brief Right image area matching a left detection.
+  ///
+  /// The left bounding rectangle rows, expanded by epipolar_margin,
+  /// swept over the disparity range of the current disparity image.
+  cv::Rect epipolarArea(const Frame& frame, const cv::Rect& left) const;
+
+  /// \brief Track an object in an area of the left or right image.
+  void trackObject(const Frame& frame, BlobTrack& track, bool right,
+		   const cv::Rect& area);
+
+  /// \brief Compute the 3d blob of an object tracked in both images.
+  void projectBlob(const Frame& frame, BlobTrack& track,
+		   ProjectionState& state);
+
+  /// \brief Label the left and right images of a frame.
+  ///
+  /// Recompile the label engines first if objects have changed.
+  void labelFrames(const Frame& frame);
+
+  /// \brief Follow the object database changes in the tracking states.
+  void updateTracking(const ObjectRegistry::snapshot_t& objects);
+
+  /// \brief Apply the node tracking parameters to an object.
+  void setupTracking(Object& object) const;
 
   /// \}
 
@@ -157,6 +275,8 @@ protected:
 
   /// \brief left image CvBridge.
   sensor_msgs::CvBridge bridgeLeft_;
+  /// \brief right image CvBridge.
+  sensor_msgs::CvBridge bridgeRight_;
   /// \brief disparity CvBridge.
   sensor_msgs::CvBridge bridgeDisparity_;
 
@@ -189,6 +309,13 @@ protected:
 
   ros::Publisher count_pub_;
 
+  /// \brief Stage latencies, see publishLatency.
+  ros::Publisher latency_pub_;
+  LatencyMonitor latency_;
+  ros::WallTimer latency_timer_;
+  /// \brief Node stages, registered once in latency_.
+  std::vector<LatencyStage*> latencyStages_;
+
   /// Resulting tracked images
   image_transport::Publisher tracked_left_pub_;
   image_transport::Publisher tracked_right_pub_;
@@ -207,12 +334,60 @@ protected:
 
   /// \brief Object database.
   ///
-  /// This associates each object name to its definition.
-  std::map<std::string, Object> left_objects_;
-  std::map<std::string, Object> right_objects_;
+  /// This associates each object name to its definition. Services
+  /// publish new versions, the frame loop tracks the current one.
+  ObjectRegistry objects_;
+
+  /// \brief Tracking state of an object.
+  ///
+  /// Each camera tracks its own copy of the object model.
+  struct TrackingState
+  {
+    /// \brief Model the objects have been copied from.
+    ObjectRegistry::model_t model;
+    Object left;
+    Object right;
+  };
+  /// \brief Tracking states, only accessed by the tracking stage.
+  std::map<std::string, TrackingState> tracking_;
+
+  struct ProjectionState
+  {
+    /// \brief Ray tables and row buffers of the object projection.
+    Reprojector reprojector;
+    /// \brief Outlier rejection of the object cloud.
+    DepthFilter depthFilter;
+    /// \brief Blob statistics when the cloud is not published.
+    BlobStatistics statistics;
+  };
+  /// \brief Projection states, only accessed by the projection stage.
+  std::map<std::string, ProjectionState> projection_;
+  /// \brief Serialize frames.
+  boost::mutex frame_mutex_;
+
+  /// \brief HSV images shared by all the objects for the current frame.
+  FrameCache frameCache_;
+
+  /// \name Single pass labeling
+  ///
+  /// When enabled, each frame is labeled once for all the objects
+  /// (see LabelEngine) instead of being back projected per object.
+  /// \{
+  bool single_pass_;
+  /// \brief Object database version the engines have been compiled for.
+  ObjectRegistry::snapshot_t labeled_;
+  LabelEngine left_labels_;
+  LabelEngine right_labels_;
+  /// \brief Label of each object in the engines.
+  std::map<std::string, unsigned char> object_labels_;
+  /// \}
 
   /// \brief Timer used to periodically report bad synchronization.
   ros::WallTimer check_synced_timer_;
+  /// \brief Timer used to periodically report dropped frames.
+  ros::WallTimer report_frames_timer_;
+  /// \brief Dropped frames count at the last report.
+  std::size_t reported_dropped_;
 
   /// \brief How many left images received so far?
   int left_received_;
@@ -223,24 +398,49 @@ protected:
   /// \brief How many synchronized images received so far?
   int all_received_;
 
-  /// \brief Last received image for the left camera.
-  sensor_msgs::ImageConstPtr leftImage_;
-  sensor_msgs::ImageConstPtr rightImage_;
-  /// \brief Last received left camera info.
-  sensor_msgs::CameraInfoConstPtr leftCamera_;
-  /// \brief Last received disparity.
-  stereo_msgs::DisparityImageConstPtr disparity_;
-
-  /// blob dectection algorithm to be used
+  /// default blob detection algorithm, "camshift" or "naive"
   std::string algo_;
   /// yaml filename that contains preloaded models
   std::string preload_models_;
+  /// precompiled models (see compile_models), used when up to date
+  std::string model_cache_;
   /// ROS frame
   std::string frame_;
   /// approximate sync for image messages
   bool is_approximate_sync_;
-
-  void publish_tracked_images(hueblob::Blobs blobs);
+  /// restrict tracking around the last known position (see Object)
+  bool roi_gating_;
+  /// minimum margin around the search window when gating, in pixels
+  int roi_margin_;
+  /// full frame reacquisition period when gating, in frames
+  int reacquire_period_;
+  /// use integral images for CamShift (see IntegralCamShift)
+  bool integral_camshift_;
+  /// also compute the blob shape from integral images
+  bool integral_second_order_;
+  /// search the right image along the left detection epipolar lines
+  bool epipolar_constraint_;
+  /// rows searched above and below the left detection, in pixels
+  int epipolar_margin_;
+  /// blob cloud outlier rejection settings (~depth_filter, ~mad_scale,
+  /// ~depth_bin, ~depth_gate), copied into each projection state
+  DepthFilter depthFilter_;
+  /// threads running per object and per camera tracking (~threads)
+  boost::scoped_ptr<WorkerPool> workers_;
+  /// thread processing the newest frame only (~latest_frame); members
+  /// are destroyed in reverse order, so the pipeline stops first, then
+  /// the projection pool, then this worker, all before workers_ and
+  /// the state their jobs use
+  boost::scoped_ptr<FrameWorker> frameWorker_;
+  /// threads running per object projection when pipelined, so that it
+  /// does not wait for the tracking tasks; declared before pipeline_,
+  /// whose project stage runs on it
+  boost::scoped_ptr<WorkerPool> projectors_;
+  /// one thread per frame stage (~pipeline), declared last so that it
+  /// stops first: its stages run tasks on projectors_ and workers_
+  boost::scoped_ptr<Pipeline<frame_t> > pipeline_;
+
+  void publish_tracked_images(const Frame& frame, hueblob::Blobs blobs);
 
 };
 
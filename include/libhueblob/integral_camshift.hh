@@ -0,0 +1,63 @@
+#ifndef HUEBLOB_INTEGRAL_CAMSHIFT_HH
+# define HUEBLOB_INTEGRAL_CAMSHIFT_HH
+# include <opencv2/core/core.hpp>
+
+# include "libhueblob/workspace.hh"
+
+/// \brief CamShift computing window moments from integral images.
+///
+/// Integral images of the probability moments (sum, x.p, y.p and
+/// optionally x2.p, x.y.p, y2.p) are built once per image. Each mean
+/// shift iteration then costs a constant number of lookups, whatever
+/// the window size. Results follow cv::CamShift.
+///
+/// Tables are stored as doubles: for images up to 1280x960 every sum
+/// is an integer below 2^53 and is therefore exact. Combine with ROI
+/// gating (see Object::roiGating_) to keep the tables small.
+class IntegralCamShift
+{
+public:
+  explicit IntegralCamShift();
+
+  /// \brief Build the moment tables of a probability image.
+  ///
+  /// \param probability CV_8UC1 probability image, kept by reference.
+  /// \param secondOrder also build the second order tables. Otherwise
+  ///        the final size and orientation are computed by cv::moments
+  ///        on the final window only.
+  void setImage(const cv::Mat& probability, bool secondOrder);
+
+  /// \brief Track in the last image, same contract as cv::CamShift.
+  cv::RotatedRect operator()(cv::Rect& window,
+			     const cv::TermCriteria& criteria) const;
+
+  /// \brief Tables allocations, see Workspace::allocations.
+  std::size_t allocations() const;
+
+private:
+  /// \brief Moments of a window, relative to the window origin.
+  struct Moments
+  {
+    double m00, m10, m01, mu20, mu11, mu02;
+  };
+
+  /// \brief Raw sum of a table over a window.
+  static double sum(const cv::Mat& table, const cv::Rect& window);
+  /// \brief First order moments only.
+  Moments firstOrder(const cv::Rect& window) const;
+  /// \brief All moments, from the tables or from the image.
+  Moments moments(const cv::Rect& window) const;
+
+  cv::Mat probability_;
+  cv::Mat sum_;
+  cv::Mat sumX_;
+  cv::Mat sumY_;
+  cv::Mat sumXX_;
+  cv::Mat sumXY_;
+  cv::Mat sumYY_;
+  bool secondOrder_;
+  /// \brief Tables storage, sized for the largest image seen.
+  Workspace workspace_;
+};
+
+#endif //! HUEBLOB_INTEGRAL_CAMSHIFT_HH
@@ -0,0 +1,69 @@
+#ifndef HUEBLOB_LABEL_ENGINE_HH
+# define HUEBLOB_LABEL_ENGINE_HH
+# include <vector>
+# include <opencv2/core/core.hpp>
+
+# include "libhueblob/object.hh"
+
+/// \brief Label every pixel with its most likely object in one pass.
+///
+/// The BGR cubes of all the compiled objects are folded into a single
+/// table giving, for each color cell, the label of the object with the
+/// highest likelihood and that likelihood. Labeling a frame is then one
+/// lookup per pixel whatever the number of objects. Each object then
+/// extracts its own likelihood from the label and score images, only
+/// over the region it tracks (see Object::track).
+///
+/// Only BGR_LOOKUP objects can be labeled: the HSV histogram of the
+/// other ones is not in the table, see accepts.
+///
+/// Object labels are their index in the vector given to compile.
+class LabelEngine
+{
+public:
+  /// \brief Maximum number of objects, labels are stored on a byte.
+  static const std::size_t max_objects = 256;
+
+  explicit LabelEngine();
+
+  /// \brief Whether an object can be tracked through the engine.
+  ///
+  /// HSV_LOOKUP and NAIVE objects must be tracked one by one.
+  static bool accepts(const Object& object);
+
+  /// \brief Build the combined lookup table.
+  ///
+  /// Must be called again whenever an object model changes. Objects
+  /// which are not accepted keep their label but never win a cell.
+  void compile(const std::vector<const Object*>& objects);
+
+  /// \brief Number of compiled objects.
+  std::size_t size() const;
+
+  /// \brief Compute the label and score images of a BGR frame.
+  void label(const cv::Mat& image);
+
+  /// \brief Extract the likelihood of one object from the last frame.
+  ///
+  /// Pixels labeled with another object have a null likelihood.
+  ///
+  /// \param label object label
+  /// \param region region of the frame to extract
+  /// \param dst CV_8UC1 likelihood image of the size of region
+  void likelihood(unsigned char label, const cv::Rect& region,
+		  cv::Mat& dst) const;
+
+  const cv::Mat& labels() const;
+  const cv::Mat& scores() const;
+
+private:
+  /// \brief Color cube table, each cell holds (label << 8) | score.
+  cv::Mat table_;
+  /// \brief Label of each pixel of the last frame.
+  cv::Mat labels_;
+  /// \brief Likelihood of the label of each pixel of the last frame.
+  cv::Mat scores_;
+  std::size_t size_;
+};
+
+#endif //! HUEBLOB_LABEL_ENGINE_HH
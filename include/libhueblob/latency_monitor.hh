@@ -0,0 +1,106 @@
+#ifndef HUEBLOB_LATENCY_MONITOR_HH
+# define HUEBLOB_LATENCY_MONITOR_HH
+# include <cstddef>
+# include <string>
+# include <vector>
+# include <boost/noncopyable.hpp>
+# include <boost/thread/mutex.hpp>
+# include "hueblob/LatencyStats.h"
+
+class LatencyMonitor;
+
+/// \brief Rolling latency samples of a processing stage.
+///
+/// Stages are registered once by LatencyMonitor::stage, then record
+/// their samples through the returned pointer: a sample only takes
+/// the stage own lock and never allocates, the ring buffer being
+/// reserved at registration.
+class LatencyStage : private boost::noncopyable
+{
+public:
+  explicit LatencyStage();
+
+  const std::string& name() const;
+
+  /// \brief Record a latency, in seconds.
+  void add(double seconds);
+
+private:
+  friend class LatencyMonitor;
+
+  std::string name_;
+  mutable boost::mutex mutex_;
+  std::vector<double> values_;
+  std::size_t next_;
+  std::size_t window_;
+};
+
+/// \brief Rolling latency statistics of named processing stages.
+///
+/// Each stage keeps its last window samples, summarized on demand
+/// into percentiles (see toMessage). Stages may be timed from several
+/// threads, each stage has its own lock.
+///
+/// Timings use a monotonic clock, see now and Scope.
+class LatencyMonitor : private boost::noncopyable
+{
+public:
+  /// \brief Maximum number of stages.
+  static const std::size_t max_stages = 64;
+
+  /// \param window samples kept per stage.
+  explicit LatencyMonitor(std::size_t window = 1000);
+
+  /// \brief Monotonic time, in seconds.
+  static double now();
+
+  /// \brief Register a stage, or find it if it already exists.
+  ///
+  /// Meant to be called at setup, not per sample: the returned stage
+  /// stays valid as long as the monitor.
+  ///
+  /// \return 0 if there are already max_stages stages, timings are
+  ///         then disabled for this stage.
+  LatencyStage* stage(const std::string& name);
+
+  /// \brief Summarize every stage with samples, in registration order.
+  void toMessage(hueblob::LatencyStats& message) const;
+
+  /// \brief Time a scope as a stage.
+  ///
+  /// Nothing is measured if the stage is null, so that timings cost
+  /// nothing when disabled.
+  class Scope : private boost::noncopyable
+  {
+  public:
+    explicit Scope(LatencyStage* stage);
+    ~Scope();
+
+  private:
+    LatencyStage* stage_;
+    double start_;
+  };
+
+private:
+  std::size_t window_;
+  /// \brief Protects the registration, not the samples.
+  mutable boost::mutex mutex_;
+  /// \brief Fixed storage, so that stages never move.
+  LatencyStage stages_[max_stages];
+  std::size_t size_;
+};
+
+inline
+LatencyMonitor::Scope::Scope(LatencyStage* stage)
+  : stage_(stage),
+    start_(stage ? LatencyMonitor::now() : 0.)
+{}
+
+inline
+LatencyMonitor::Scope::~Scope()
+{
+  if (stage_)
+    stage_->add(LatencyMonitor::now() - start_);
+}
+
+#endif //! HUEBLOB_LATENCY_MONITOR_HH
@@ -0,0 +1,19 @@
+#ifndef HUEBLOB_LIKELIHOOD_HH
+# define HUEBLOB_LIKELIHOOD_HH
+# include <opencv2/core/core.hpp>
+
+/// \brief Map a BGR image to object likelihoods in a single pass.
+///
+/// Color conversion, back projection, views merging and thresholding
+/// are all folded into the color cube table (see Object::compileModel)
+/// so each pixel costs one table lookup. An AVX2 implementation is
+/// selected at run-time when the CPU supports it, otherwise a scalar
+/// loop is used.
+///
+/// \param image CV_8UC3 BGR image
+/// \param lut color cube table, followed by three padding bytes
+/// \param dst CV_8UC1 likelihood image, only reallocated when the
+///            image size changes
+void lookupLikelihood(const cv::Mat& image, const cv::Mat& lut, cv::Mat& dst);
+
+#endif //! HUEBLOB_LIKELIHOOD_HH
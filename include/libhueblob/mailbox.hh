@@ -0,0 +1,54 @@
+#ifndef HUEBLOB_MAILBOX_HH
+# define HUEBLOB_MAILBOX_HH
+# include <boost/noncopyable.hpp>
+# include <boost/thread/mutex.hpp>
+
+/// \brief Single slot mailbox between a producer and a hot thread.
+///
+/// The producer posts values, a newer value replacing an unread one.
+/// The consumer polls the mailbox, typically once per frame. Polling
+/// never blocks: if a producer is posting at that time, the value is
+/// picked up at the next poll instead.
+///
+/// Keep T cheap to copy (e.g. a shared pointer to a value built by the
+/// producer), copies are made with the mailbox lock held.
+template <typename T>
+class Mailbox : private boost::noncopyable
+{
+public:
+  explicit Mailbox()
+    : mutex_(),
+      value_(),
+      full_(false)
+  {}
+
+  /// \brief Post a value, replacing the unread one if any.
+  void post(const T& value)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    value_ = value;
+    full_ = true;
+  }
+
+  /// \brief Take the last posted value, never blocks.
+  ///
+  /// \param value set to the posted value, if any.
+  /// \return true if a value has been taken.
+  bool take(T& value)
+  {
+    boost::mutex::scoped_try_lock lock(mutex_);
+    if (!lock.owns_lock() || !full_)
+      return false;
+    value = value_;
+    value_ = T();
+    full_ = false;
+    return true;
+  }
+
+private:
+  boost::mutex mutex_;
+  T value_;
+  bool full_;
+};
+
+#endif //! HUEBLOB_MAILBOX_HH
@@ -0,0 +1,68 @@
+#ifndef HUEBLOB_MODEL_CACHE_HH
+# define HUEBLOB_MODEL_CACHE_HH
+# include <string>
+# include <vector>
+
+# include "libhueblob/object.hh"
+
+/// \brief Compiled object model, as stored in a model cache.
+///
+/// Only the model part of the object is stored: anchor, view and hue
+/// histograms, compiled histogram, lookup tables and hue bounds (see
+/// Object::copyModel). Tracking settings come from the node
+/// parameters.
+struct CachedModel
+{
+  /// \brief Object name.
+  std::string name;
+  /// \brief Source image the model has been compiled from.
+  std::string path;
+  Object object;
+};
+
+/// \brief Write compiled models to a binary cache file.
+///
+/// The file starts with the bin layout (histogram bins, BGR cube bits)
+/// so that caches built with other settings are rejected when loaded.
+/// Data is stored in native byte order, caches are not meant to be
+/// shared between machines.
+///
+/// \throw std::runtime_error if the file cannot be written.
+void saveModelCache(const std::string& filename,
+		    const std::vector<CachedModel>& models);
+
+/// \brief Map a cache file and load its models.
+///
+/// \return false if the file is missing, truncated or has been built
+///         with another bin layout.
+bool loadModelCache(const std::string& filename,
+		    std::vector<CachedModel>& models);
+
+/// \brief Is a cache file newer than all its sources?
+///
+/// \param filename cache file
+/// \param sources files the cache has been built from, typically the
+///        models list and the model images.
+bool modelCacheFresh(const std::string& filename,
+		     const std::vector<std::string>& sources);
+
+/// \brief Find the cached model of an object.
+///
+/// A model is only used if it has been compiled from the requested
+/// image: entries with the same name but another source are ignored.
+/// Paths are compared once made canonical, when they exist.
+///
+/// \return 0 if there is no such model.
+const CachedModel* findCachedModel(const std::vector<CachedModel>& models,
+				   const std::string& name,
+				   const std::string& path);
+
+/// \brief Convert a model URL into a filesystem path.
+///
+/// Handles package:// and file:// URLs, other values are returned
+/// as is.
+///
+/// \return an empty string if the package cannot be found.
+std::string resolveModelPath(const std::string& url);
+
+#endif //! HUEBLOB_MODEL_CACHE_HH
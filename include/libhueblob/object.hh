@@ -4,6 +4,9 @@
 # include <boost/optional.hpp>
 # include <opencv2/core/core.hpp>
 
+# include "libhueblob/integral_camshift.hh"
+# include "libhueblob/workspace.hh"
+
 /// \brief Define an object of the object database.
 ///
 /// An object is recognized by storing its histogram
@@ -12,44 +15,174 @@
 /// A 3d offset called anchor is also provided to tune
 /// the position of the 3d point associated with an object.
 
+class LabelEngine;
+class LatencyMonitor;
+class LatencyStage;
+
+/// \brief Tracking algorithm.
+///
+/// CAMSHIFT runs CamShift on the back projection of the model
+/// histogram. NAIVE keeps the pixels whose hue lies in the model hue
+/// range and returns the largest connected component: much cheaper,
+/// but only suited to saturated and well lit objects.
 typedef enum{
   CAMSHIFT = 0,
   NAIVE = 1,
 } algo_t;
 
+/// \brief Color space used to look up the model during tracking.
+///
+/// HSV_LOOKUP converts each frame to HSV and back projects the
+/// compiled histogram. BGR_LOOKUP maps the BGR pixels directly through
+/// a quantized color cube precomputed from the same histogram.
+typedef enum{
+  HSV_LOOKUP = 0,
+  BGR_LOOKUP = 1,
+} lookup_t;
+
 struct Object {
   static const int h_bins = 25;
   static const int s_bins = 25;
+  /// \brief Bins of the hue histograms, one per OpenCV hue value.
+  static const int hue_bins = 180;
+  /// \brief Bits kept per BGR channel in the lookup cube.
+  static const int bgr_bits = 5;
   explicit Object();
 
 
   /// \brief Build the view histogram and append it to modelHistogram.
   ///
   /// The histogram is done on the hue and saturation components on
-  /// the view.
+  /// the view. The hue histogram of the saturated pixels is appended
+  /// to hueHistogram, for the naive algorithm.
   ///
   /// \param view reference to the view
   void addView(const cv::Mat& view);
   void clearViews();
 
+  /// \brief Replace the model by the model of another object.
+  ///
+  /// Copies the anchor, the histograms, the lookup tables and the hue
+  /// bounds, but neither the tracking settings nor the tracking state.
+  /// Used to load precompiled models (see model_cache.hh).
+  void copyModel(const Object& model);
+
+  /// \brief Fold all the views histograms into compiledHistogram.
+  ///
+  /// Called by addView and clearViews. Each bin of the compiled
+  /// histogram holds the saturated sum of the views bins so that a
+  /// single back projection gives the same result as merging the
+  /// back projections of every view. The hue range and naiveLut are
+  /// derived from hueHistogram.
+  void compileModel();
+
   /// \brief Track the object in the current image.
   ///
   /// \param image track in which the object will be tracked.
   /// \return a rotated rectangle if the object has been successfully tracked,
   ///         otherwise nothing.
   boost::optional<cv::RotatedRect> track(const cv::Mat& image);
+
+  /// \brief Track the object using a precomputed HSV image.
+  ///
+  /// \param image track in which the object will be tracked.
+  /// \param hsv image converted to HSV (see FrameCache), only read when
+  ///        the HSV lookup is used. If empty, the object converts the
+  ///        image itself.
+  boost::optional<cv::RotatedRect> track(const cv::Mat& image,
+					 const cv::Mat& hsv);
+
+  /// \brief Track the object inside an area of the image.
+  ///
+  /// Pixels outside area are never read, it is clipped to the image.
+  /// Used to restrict the right camera search along the epipolar
+  /// lines (see HueBlob).
+  boost::optional<cv::RotatedRect> track(const cv::Mat& image,
+					 const cv::Mat& hsv,
+					 const cv::Rect& area);
+
+  /// \brief Track the object in the last frame labeled by an engine.
+  ///
+  /// \param engine engine the object has been compiled into.
+  /// \param label object label in the engine.
+  boost::optional<cv::RotatedRect> track(const LabelEngine& engine,
+					 unsigned char label);
+  boost::optional<cv::RotatedRect> track(const LabelEngine& engine,
+					 unsigned char label,
+					 const cv::Rect& area);
   void setSearchWindow(const cv::Rect window);
 
+  /// \brief Choose the image region processed for the current frame.
+  ///
+  /// This is the whole area unless ROI gating is enabled, see
+  /// roiGating.
+  ///
+  /// \param area part of the frame the object may be searched in.
+  cv::Rect trackingRegion(const cv::Rect& area);
+
+  /// \brief Whether track reads an HSV image over the whole area.
+  ///
+  /// Only then does a conversion shared across objects (see
+  /// FrameCache) pay off: with ROI gating or pyramid tracking, track
+  /// only reads a region, which it converts itself when given no HSV
+  /// image.
+  bool readsAreaHsv() const;
+
+  /// \brief Run CamShift on a likelihood image and update searchWindow.
+  ///
+  /// \param likelihood filtered likelihood computed over region.
+  /// \param region location of likelihood in the frame.
+  /// \param scaleX width of a likelihood pixel in the frame.
+  /// \param scaleY height of a likelihood pixel in the frame.
+  boost::optional<cv::RotatedRect>
+  trackLikelihood(const cv::Mat& likelihood, const cv::Rect& region,
+		  double scaleX = 1., double scaleY = 1.);
+
+  /// \brief Track with the naive algorithm, see algo_t.
+  boost::optional<cv::RotatedRect> trackNaive(const cv::Mat& image,
+					      const cv::Rect& area);
+
+  /// \brief Coarse to fine tracking, see pyramidLevels.
+  boost::optional<cv::RotatedRect> trackPyramid(const cv::Mat& image,
+						const cv::Mat& hsv,
+						const cv::Rect& area);
+
+  /// \brief Fill likelihood with the filtered back projection of image.
+  ///
+  /// Used internally by track, image and hsv may be regions of the
+  /// frame.
+  void computeLikelihood(const cv::Mat& image, const cv::Mat& hsv);
+
 
   /// \brief Compute image mask used for histogram computation.
   ///
   /// Used internally by addView. The non zero values of this image
   /// indicates pixel to will be taken into account during the
-  /// histogram computation step.
+  /// histogram computation step. The mask is stored in the workspace
+  /// and is overwritten by the next call.
   ///
   /// \param view reference to the view
   cv::Mat computeMask(const cv::Mat& model);
 
+  /// \brief Number of Workspace buffer allocations done by tracking.
+  ///
+  /// Only the Workspace buffers and the IntegralCamShift tables are
+  /// counted: only the first frame, or a larger one, should allocate
+  /// them. This checks workspace reuse, not the absence of per-frame
+  /// heap allocation: temporaries allocated inside OpenCV, e.g. by
+  /// cv::CamShift, medianBlur or cvtColor, are not measured.
+  std::size_t workspaceAllocations() const;
+
+  /// \brief Time the tracking substeps into latency, or nothing if
+  /// null, the default.
+  ///
+  /// Stages: cvt_color, back_projection, threshold, median and
+  /// camshift. They are registered here, once, and are not copied by
+  /// copyModel.
+  void setLatency(LatencyMonitor* latency);
+  /// \brief Stage registered by setLatency, null when disabled.
+  LatencyStage* latencyStage(std::size_t stage) const;
+
   /// \name Anchor
   /// \{
   double anchor_x_;
@@ -60,20 +193,86 @@ struct Object {
   /// \brief Contains all the histograms associated with this object.
   // hue and sat used by CAMShift algorithm
   std::vector<cv::MatND> modelHistogram_;
+  /// \brief Saturated union of modelHistogram, used for tracking.
+  cv::MatND compiledHistogram_;
+  /// \brief compiledHistogram evaluated on a quantized BGR cube.
+  ///
+  /// Row vector indexed by (b << 2 * bgr_bits) | (g << bgr_bits) | r,
+  /// each channel being shifted right to keep bgr_bits bits. The
+  /// likelihood threshold is already applied and three padding bytes
+  /// follow the table.
+  cv::Mat bgrLut_;
+  /// \brief Which of the two tables above is used by track.
+  lookup_t lookup_;
+  /// \brief Tracking algorithm.
+  algo_t algo_;
 
-  // only hue
+  /// \brief Hue histograms of the views, used by the naive algorithm.
   std::vector<cv::MatND> hueHistogram_;
-  // bounding hues
+  /// \name Naive algorithm HSV bounds
+  ///
+  /// Hue bounds surround the hue histogram peak, the range wraps
+  /// around red when the lower hue is greater than the upper one.
+  /// \{
   cv::Scalar lower_hue_;
   cv::Scalar upper_hue_;
+  /// \}
+  /// \brief HSV color of the hue histogram peak.
   cv::Scalar peak_color_;
+  /// \brief Membership of the HSV bounds, on the BGR cube of bgrLut.
+  ///
+  /// Cells inside the bounds hold 255, others 0.
+  cv::Mat naiveLut_;
+  /// \brief Connected components of the last naive mask.
+  std::vector<std::vector<cv::Point> > contours_;
   /// \brief Object search window.
   ///
   /// Where the object has been seen the last time it has been
   /// successfully tracked.
   cv::Rect searchWindow_;
-  cv::Mat imgHSV_;
 
+  /// \name ROI gating
+  ///
+  /// When enabled, per-pixel work is restricted to the search window
+  /// expanded by max(roiMargin, half the window size) as long as the
+  /// object is tracked. The whole frame is processed when the track is
+  /// lost and every reacquirePeriod frames.
+  /// \{
+  bool roiGating_;
+  int roiMargin_;
+  int reacquirePeriod_;
+  int framesSinceReacquire_;
+  /// \}
+
+  /// \brief Number of pyramid levels used for coarse tracking.
+  ///
+  /// When non zero, back projection and CamShift first run on the
+  /// image downscaled pyramidLevels times by two, then CamShift runs
+  /// again at full resolution on the coarse window plus a margin of a
+  /// few coarse pixels, whose likelihood is computed in full. This
+  /// only pays off when the object is small compared to the tracked
+  /// region (no roiGating, or a wide margin): for an object filling
+  /// the region, the coarse pass comes on top of a full resolution
+  /// pass of about the same size. Not used when tracking from a
+  /// LabelEngine.
+  int pyramidLevels_;
+
+  /// \brief Use IntegralCamShift instead of cv::CamShift.
+  bool integralCamShift_;
+  /// \brief Also compute size and orientation from integral images.
+  bool integralSecondOrder_;
+  IntegralCamShift camShift_;
+
+  /// \brief Scratch images, sized on the first frame and then reused.
+  Workspace workspace_;
+  /// \brief Thresholded back projection, a view on workspace.
+  cv::Mat backProject_;
+  /// \brief Filtered back projection CamShift runs on, a view on
+  /// workspace.
+  cv::Mat likelihood_;
+
+  /// \brief Stages of setLatency, empty when timings are disabled.
+  std::vector<LatencyStage*> latency_;
 };
 
 #endif //! HUEBLOB_OBJECT_HH
@@ -0,0 +1,54 @@
+#ifndef HUEBLOB_OBJECT_REGISTRY_HH
+# define HUEBLOB_OBJECT_REGISTRY_HH
+# include <map>
+# include <string>
+# include <boost/noncopyable.hpp>
+# include <boost/shared_ptr.hpp>
+# include <boost/thread/mutex.hpp>
+
+# include "libhueblob/object.hh"
+
+/// \brief Object database made of immutable snapshots.
+///
+/// Readers get the current snapshot and keep using it as long as they
+/// need, writers publish a new snapshot instead of modifying the
+/// current one (read-copy-update). Objects of a snapshot are models:
+/// they are never tracked directly, trackers copy them into their own
+/// tracking state (see HueBlob::TrackingState).
+///
+/// Getting a snapshot only copies a pointer under a dedicated mutex,
+/// which writers only hold to swap that pointer: models compilation
+/// and map copies never block readers.
+class ObjectRegistry : private boost::noncopyable
+{
+public:
+  typedef boost::shared_ptr<const Object> model_t;
+  typedef std::map<std::string, model_t> models_t;
+  typedef boost::shared_ptr<const models_t> snapshot_t;
+
+  explicit ObjectRegistry();
+
+  /// \brief Current version of the database, never null.
+  snapshot_t snapshot() const;
+
+  /// \brief Add or replace an object.
+  void insert(const std::string& name, const model_t& model);
+  /// \brief Add or replace several objects in a single version.
+  void insert(const models_t& models);
+  /// \brief Remove an object.
+  ///
+  /// \return false if there was no such object.
+  bool erase(const std::string& name);
+
+private:
+  /// \brief Make a new version current.
+  void publish(const snapshot_t& snapshot);
+
+  snapshot_t current_;
+  /// \brief Protect current, only held to copy or swap the pointer.
+  mutable boost::mutex current_mutex_;
+  /// \brief Serialize writers.
+  boost::mutex write_mutex_;
+};
+
+#endif //! HUEBLOB_OBJECT_REGISTRY_HH
@@ -0,0 +1,213 @@
+#ifndef HUEBLOB_PIPELINE_HH
+# define HUEBLOB_PIPELINE_HH
+# include <cstddef>
+# include <deque>
+# include <exception>
+# include <vector>
+# include <boost/bind.hpp>
+# include <boost/function.hpp>
+# include <boost/noncopyable.hpp>
+# include <boost/thread/condition_variable.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/thread.hpp>
+# include <ros/console.h>
+
+/// \brief Stages run concurrently on successive items.
+///
+/// Each stage has its own thread and input queue: while a stage
+/// processes item n, the previous one already processes item n + 1.
+/// The throughput is then bounded by the slowest stage instead of the
+/// sum of all of them. Stages run their items one at a time and in
+/// order, so items leave the pipeline in the order they were pushed,
+/// and a stage may keep state from one item to the next.
+///
+/// Queues are bounded: when a stage falls behind, the previous ones
+/// wait, up to push.
+///
+/// Keep T cheap to copy (e.g. a shared pointer to the frame state),
+/// items are copied from one queue to the next.
+template <typename T>
+class Pipeline : private boost::noncopyable
+{
+public:
+  typedef boost::function<void (T&)> stage_t;
+
+  /// \brief Start one thread per stage.
+  ///
+  /// \param stages stages, in order.
+  /// \param capacity maximum number of items waiting for a stage,
+  ///        zero is treated as one.
+  explicit Pipeline(const std::vector<stage_t>& stages, std::size_t capacity);
+  /// \brief Wait for the running stages, pending items are dropped.
+  ~Pipeline();
+
+  /// \brief Push an item, waiting while the first queue is full.
+  void push(const T& item);
+
+  /// \brief Wait until all the pushed items have left the pipeline.
+  void flush();
+
+  /// \brief Items which went through all the stages.
+  std::size_t processed() const;
+  /// \brief Items dropped because a stage has thrown an exception.
+  std::size_t failed() const;
+
+private:
+  /// \brief Stage threads main loop.
+  void work(std::size_t stage);
+  /// \brief Wait for room in a queue, then enqueue.
+  ///
+  /// \return false if the pipeline is stopping.
+  bool enqueue(boost::unique_lock<boost::mutex>& lock,
+	       std::size_t stage, const T& item);
+
+  std::vector<stage_t> stages_;
+  std::size_t capacity_;
+
+  /// \name Queues and counters, protected by mutex.
+  /// \{
+  mutable boost::mutex mutex_;
+  boost::condition_variable changed_;
+  std::vector<std::deque<T> > queues_;
+  /// \brief Items pushed which have not left the pipeline yet.
+  std::size_t pending_;
+  std::size_t processed_;
+  std::size_t failed_;
+  bool stop_;
+  /// \}
+
+  boost::thread_group threads_;
+};
+
+template <typename T>
+Pipeline<T>::Pipeline(const std::vector<stage_t>& stages,
+		      std::size_t capacity)
+  : stages_(stages),
+    capacity_(capacity ? capacity : 1),
+    mutex_(),
+    changed_(),
+    queues_(stages.size()),
+    pending_(),
+    processed_(),
+    failed_(),
+    stop_(false),
+    threads_()
+{
+  for (std::size_t i = 0; i < stages_.size(); ++i)
+    threads_.create_thread(boost::bind(&Pipeline::work, this, i));
+}
+
+template <typename T>
+Pipeline<T>::~Pipeline()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  threads_.join_all();
+}
+
+template <typename T>
+void
+Pipeline<T>::push(const T& item)
+{
+  if (stages_.empty())
+    return;
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  ++pending_;
+  if (!enqueue(lock, 0, item))
+    --pending_;
+}
+
+template <typename T>
+void
+Pipeline<T>::flush()
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (pending_ && !stop_)
+    changed_.wait(lock);
+}
+
+template <typename T>
+std::size_t
+Pipeline<T>::processed() const
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  return processed_;
+}
+
+template <typename T>
+std::size_t
+Pipeline<T>::failed() const
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  return failed_;
+}
+
+template <typename T>
+bool
+Pipeline<T>::enqueue(boost::unique_lock<boost::mutex>& lock,
+		     std::size_t stage, const T& item)
+{
+  while (!stop_ && queues_[stage].size() >= capacity_)
+    changed_.wait(lock);
+  if (stop_)
+    return false;
+  queues_[stage].push_back(item);
+  changed_.notify_all();
+  return true;
+}
+
+template <typename T>
+void
+Pipeline<T>::work(std::size_t stage)
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (true)
+    {
+      while (!stop_ && queues_[stage].empty())
+	changed_.wait(lock);
+      if (stop_)
+	return;
+
+      T item = queues_[stage].front();
+      queues_[stage].pop_front();
+      changed_.notify_all();
+      bool failed = false;
+
+      lock.unlock();
+      try
+	{
+	  stages_[stage](item);
+	}
+      catch (const std::exception& e)
+	{
+	  ROS_ERROR("pipeline stage %u failed: %s", unsigned(stage), e.what());
+	  failed = true;
+	}
+      catch (...)
+	{
+	  ROS_ERROR("pipeline stage %u failed: unknown exception",
+		    unsigned(stage));
+	  failed = true;
+	}
+      lock.lock();
+
+      // Later stages expect the results of the failed one.
+      if (!failed && stage + 1 < stages_.size())
+	{
+	  if (!enqueue(lock, stage + 1, item))
+	    return;
+	  continue;
+	}
+      if (failed)
+	++failed_;
+      else
+	++processed_;
+      --pending_;
+      changed_.notify_all();
+    }
+}
+
+#endif //! HUEBLOB_PIPELINE_HH
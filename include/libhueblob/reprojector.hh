@@ -0,0 +1,129 @@
+#ifndef HUEBLOB_REPROJECTOR_HH
+# define HUEBLOB_REPROJECTOR_HH
+# include <cstddef>
+# include <vector>
+# include <opencv2/core/core.hpp>
+
+/// \brief Reproject disparity pixels to 3d points.
+///
+/// A pixel (u, v) of disparity d lies at depth z = fT / d on the ray
+/// ((u - cx) / fx, (v - cy) / fy, 1). The ray factors only depend on
+/// the camera intrinsics, they are tabulated per column and per row
+/// when the camera changes so that each pixel costs one division and
+/// two multiplications. Rows are processed four pixels at a time with
+/// SSE2 when available.
+///
+/// Pixels whose disparity is null, NaN or outside the disparity range
+/// are skipped.
+class Reprojector
+{
+public:
+  explicit Reprojector();
+
+  /// \brief Set the camera intrinsics and the image size.
+  ///
+  /// \return true if the ray tables have been rebuilt, false if the
+  ///         camera did not change.
+  bool setCamera(double fx, double fy, double cx, double cy,
+		 int width, int height);
+
+  /// \brief Set the depth scale and the valid disparity range.
+  ///
+  /// \param focalBaseline focal length times baseline (f * T in
+  ///        stereo_msgs::DisparityImage).
+  void setDisparity(float focalBaseline,
+		    float minDisparity, float maxDisparity);
+
+  /// \brief Reproject the valid pixels of a region.
+  ///
+  /// Points are written to points, which is resized to the region
+  /// area first and then shrunk to the number of valid pixels, so a
+  /// reused container no longer allocates once it has seen the
+  /// largest region.
+  ///
+  /// \param disparity CV_32FC1 disparity image.
+  /// \param rect region, clipped to the image and to the camera size.
+  /// \param points container of points with x, y and z members.
+  /// \param pixels if non null, receives the index of each point pixel
+  ///        in rect, row major.
+  /// \return number of points.
+  template <typename Points>
+  std::size_t project(const cv::Mat& disparity, const cv::Rect& rect,
+		      Points& points, std::vector<int>* pixels = 0);
+
+  /// \brief Reproject a single pixel, the disparity is not checked.
+  cv::Point3f point(float u, float v, float disparity) const;
+
+  /// \brief Reproject the valid pixels of a row segment [begin, end).
+  ///
+  /// Results are stored in the row buffers, see rowX, rowY, rowZ and
+  /// rowColumns, until the next call.
+  ///
+  /// \return number of valid pixels.
+  int projectRow(const float* disparity, int row, int begin, int end);
+
+  const float* rowX() const;
+  const float* rowY() const;
+  const float* rowZ() const;
+  const int* rowColumns() const;
+
+private:
+  double fx_;
+  double fy_;
+  double cx_;
+  double cy_;
+  /// \brief (u - cx) / fx, one per column.
+  std::vector<float> columnRays_;
+  /// \brief (v - cy) / fy, one per row.
+  std::vector<float> rowRays_;
+
+  float focalBaseline_;
+  float minDisparity_;
+  float maxDisparity_;
+
+  /// \name Row buffers, sized to the image width.
+  /// \{
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> z_;
+  std::vector<int> columns_;
+  /// \}
+};
+
+template <typename Points>
+std::size_t
+Reprojector::project(const cv::Mat& disparity, const cv::Rect& rect,
+		     Points& points, std::vector<int>* pixels)
+{
+  CV_Assert(disparity.type() == CV_32FC1);
+  const cv::Rect area = rect
+    & cv::Rect(0, 0, disparity.cols, disparity.rows)
+    & cv::Rect(0, 0, columnRays_.size(), rowRays_.size());
+  const std::size_t capacity =
+    area.width > 0 && area.height > 0 ? area.area() : 0;
+  points.resize(capacity);
+  if (pixels)
+    pixels->resize(capacity);
+
+  std::size_t count = 0;
+  for (int row = area.y; row < area.y + area.height; ++row)
+    {
+      const int n = projectRow(disparity.ptr<float>(row), row,
+			       area.x, area.x + area.width);
+      for (int i = 0; i < n; ++i, ++count)
+	{
+	  points[count].x = x_[i];
+	  points[count].y = y_[i];
+	  points[count].z = z_[i];
+	  if (pixels)
+	    (*pixels)[count] =
+	      (row - rect.y) * rect.width + columns_[i] - rect.x;
+	}
+    }
+  points.resize(count);
+  if (pixels)
+    pixels->resize(count);
+  return count;
+}
+
+#endif //! HUEBLOB_REPROJECTOR_HH
@@ -0,0 +1,66 @@
+#ifndef HUEBLOB_WORKER_POOL_HH
+# define HUEBLOB_WORKER_POOL_HH
+# include <cstddef>
+# include <string>
+# include <vector>
+# include <boost/function.hpp>
+# include <boost/noncopyable.hpp>
+# include <boost/thread/condition_variable.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/thread.hpp>
+
+/// \brief Fixed size pool of threads running batches of tasks.
+///
+/// The calling thread takes part in the work, so a pool of n threads
+/// runs up to n tasks at the same time using n - 1 extra threads. A
+/// pool of one thread runs the tasks in order in the calling thread.
+class WorkerPool : private boost::noncopyable
+{
+public:
+  typedef boost::function<void ()> task_t;
+
+  /// \brief Start the pool.
+  ///
+  /// \param threads maximum number of tasks run concurrently, zero is
+  ///        treated as one.
+  explicit WorkerPool(unsigned threads);
+  ~WorkerPool();
+
+  /// \brief Maximum number of tasks run concurrently.
+  unsigned size() const;
+
+  /// \brief Run a batch of tasks and wait for all of them to finish.
+  ///
+  /// Tasks may run in any order. If some of them throw, the others are
+  /// still run and a std::runtime_error describing the first failure
+  /// is thrown once the batch is done.
+  void run(const std::vector<task_t>& tasks);
+
+private:
+  /// \brief Worker threads main loop.
+  void work();
+  /// \brief Run the next tasks of the current batch, if any.
+  ///
+  /// \param lock held lock on mutex, released while a task runs.
+  void drain(boost::unique_lock<boost::mutex>& lock);
+
+  unsigned size_;
+  boost::thread_group threads_;
+
+  /// \brief Serialize calls to run.
+  boost::mutex run_mutex_;
+
+  /// \name Current batch, protected by mutex.
+  /// \{
+  boost::mutex mutex_;
+  boost::condition_variable work_;
+  boost::condition_variable done_;
+  const std::vector<task_t>* batch_;
+  std::size_t next_;
+  std::size_t pending_;
+  std::string error_;
+  bool stop_;
+  /// \}
+};
+
+#endif //! HUEBLOB_WORKER_POOL_HH
@@ -0,0 +1,46 @@
+#ifndef HUEBLOB_WORKSPACE_HH
+# define HUEBLOB_WORKSPACE_HH
+# include <cstddef>
+# include <vector>
+# include <opencv2/core/core.hpp>
+
+/// \brief Scratch images reused from one frame to the next.
+///
+/// Each slot owns a buffer which only grows: requesting a smaller
+/// image returns a view on the top left corner of the existing buffer.
+/// Once every slot has been used at the largest resolution, typically
+/// on the first full frame, tracking no longer allocates.
+///
+/// Every buffer (re)allocation is counted, so that tests can check
+/// the steady-state allocation count is null.
+///
+/// Copies never share buffers: a copied workspace starts empty.
+class Workspace
+{
+public:
+  explicit Workspace();
+  Workspace(const Workspace&);
+  Workspace& operator=(const Workspace&);
+
+  /// \brief Get a scratch image of the given size and type.
+  ///
+  /// The content is undefined. The returned image is valid until the
+  /// same slot is requested again with a larger size or another type.
+  ///
+  /// \param slot buffer index, chosen by the owner
+  /// \param size image size
+  /// \param type OpenCV type, e.g. CV_8UC1
+  cv::Mat buffer(std::size_t slot, const cv::Size& size, int type);
+
+  /// \brief Allocate a slot in advance, see buffer.
+  void reserve(std::size_t slot, const cv::Size& size, int type);
+
+  /// \brief Number of buffer allocations since construction.
+  std::size_t allocations() const;
+
+private:
+  std::vector<cv::Mat> buffers_;
+  std::size_t allocations_;
+};
+
+#endif //! HUEBLOB_WORKSPACE_HH
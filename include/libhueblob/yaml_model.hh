@@ -0,0 +1,40 @@
+#ifndef HUEBLOB_YAML_MODEL_HH
+# define HUEBLOB_YAML_MODEL_HH
+# include <string>
+# include <vector>
+
+# include "libhueblob/object.hh"
+
+/// \brief Entry of a models list (see the ~models parameter).
+///
+/// Only name and path are mandatory, e.g.
+/// \code
+/// - name: rose
+///   path: data/models/ball-rose.png
+///   lookup: bgr
+///   algo: naive
+///   pyramid_levels: 1
+/// \endcode
+struct YamlModel {
+  std::string name;
+  std::string path;
+  /// \brief Color space used for tracking ("hsv" or "bgr").
+  std::string lookup;
+  /// \brief Tracking algorithm ("camshift" or "naive").
+  std::string algo;
+  /// \brief Coarse to fine tracking levels, see Object::pyramidLevels_.
+  int pyramid_levels;
+};
+
+/// \brief Parse a models list file.
+///
+/// \throw YAML::Exception if the file is not a valid models list.
+std::vector<YamlModel> readYamlModels(const std::string& filename);
+
+/// \brief Convert a lookup parameter value into a lookup_t.
+lookup_t parseLookup(const std::string& lookup);
+
+/// \brief Convert an algorithm parameter value into an algo_t.
+algo_t parseAlgo(const std::string& algo);
+
+#endif //! HUEBLOB_YAML_MODEL_HH
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include "libhueblob/blob_statistics.hh"
+#include "libhueblob/depth_filter.hh"
+#include "libhueblob/ellipse_mask.hh"
+#include "libhueblob/reprojector.hh"
+
+const std::size_t BlobStatistics::bins_per_meter;
+const std::size_t BlobStatistics::max_bins;
+
+BlobStatistics::BlobStatistics()
+  : inliers_(),
+    centroid_(),
+    min_(),
+    max_(),
+    added_(),
+    bins_(max_bins),
+    first_(max_bins),
+    last_(0),
+    depths_(),
+    counts_()
+{
+  for (std::size_t i = 0; i < bins_.size(); ++i)
+    bins_[i].count = 0;
+}
+
+void
+BlobStatistics::reset()
+{
+  // Only the bins added to are cleared.
+  for (std::size_t i = first_; i <= last_ && i < max_bins; ++i)
+    bins_[i].count = 0;
+  first_ = max_bins;
+  last_ = 0;
+  added_ = 0;
+  inliers_ = 0;
+}
+
+void
+BlobStatistics::add(Reprojector& reprojector, const cv::Mat& disparity,
+		    const cv::Rect& rect, const cv::Mat& mask)
+{
+  CV_Assert(disparity.type() == CV_32FC1);
+  CV_Assert(mask.empty() || (mask.type() == CV_8UC1
+			     && mask.rows == rect.height
+			     && mask.cols == rect.width));
+  const cv::Rect area = rect & cv::Rect(0, 0, disparity.cols, disparity.rows);
+  for (int row = area.y; row < area.y + area.height; ++row)
+    {
+      const int n = reprojector.projectRow(disparity.ptr<float>(row), row,
+					   area.x, area.x + area.width);
+      const float* x = reprojector.rowX();
+      const float* y = reprojector.rowY();
+      const float* z = reprojector.rowZ();
+      const int* columns = reprojector.rowColumns();
+      const unsigned char* masked =
+	mask.empty() ? 0 : mask.ptr<unsigned char>(row - rect.y) - rect.x;
+      for (int i = 0; i < n; ++i)
+	if (!masked || masked[columns[i]])
+	  add(x[i], y[i], z[i]);
+    }
+}
+
+void
+BlobStatistics::add(Reprojector& reprojector, const cv::Mat& disparity,
+		    const EllipseMask& mask)
+{
+  CV_Assert(disparity.type() == CV_32FC1);
+  const cv::Rect& rect = mask.rect();
+  const int firstRow = std::max(rect.y, 0);
+  const int lastRow = std::min(rect.y + rect.height, disparity.rows);
+  for (int row = firstRow; row < lastRow; ++row)
+    {
+      const int begin = std::max(rect.x + mask.begin(row - rect.y), 0);
+      const int end = std::min(rect.x + mask.end(row - rect.y),
+			       disparity.cols);
+      if (begin >= end)
+	continue;
+      const int n = reprojector.projectRow(disparity.ptr<float>(row), row,
+					   begin, end);
+      const float* x = reprojector.rowX();
+      const float* y = reprojector.rowY();
+      const float* z = reprojector.rowZ();
+      for (int i = 0; i < n; ++i)
+	add(x[i], y[i], z[i]);
+    }
+}
+
+bool
+BlobStatistics::compute(DepthFilter& filter)
+{
+  inliers_ = 0;
+  if (!added_)
+    return false;
+
+  // Same rejection as the filtered cloud, at the bins resolution.
+  depths_.clear();
+  counts_.clear();
+  for (std::size_t i = first_; i <= last_; ++i)
+    if (bins_[i].count)
+      {
+	depths_.push_back(bins_[i].sum.z / bins_[i].count);
+	counts_.push_back(bins_[i].count);
+      }
+  float low, high;
+  if (!filter.depthRange(depths_, counts_, low, high))
+    return false;
+
+  cv::Point3d sum(0., 0., 0.);
+  for (std::size_t i = first_, j = 0; i <= last_; ++i)
+    {
+      const Bin& bin = bins_[i];
+      if (!bin.count)
+	continue;
+      const float depth = depths_[j++];
+      if (depth < low || depth > high)
+	continue;
+      if (!inliers_)
+	{
+	  min_ = bin.min;
+	  max_ = bin.max;
+	}
+      inliers_ += bin.count;
+      sum += bin.sum;
+      min_.x = std::min(min_.x, bin.min.x);
+      min_.y = std::min(min_.y, bin.min.y);
+      min_.z = std::min(min_.z, bin.min.z);
+      max_.x = std::max(max_.x, bin.max.x);
+      max_.y = std::max(max_.y, bin.max.y);
+      max_.z = std::max(max_.z, bin.max.z);
+    }
+  if (!inliers_)
+    return false;
+  centroid_ = cv::Point3f(sum.x / inliers_, sum.y / inliers_,
+			  sum.z / inliers_);
+  return true;
+}
+
+std::size_t
+BlobStatistics::points() const
+{
+  return added_;
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+#include <ros/console.h>
+#include "libhueblob/depth_filter.hh"
+
+namespace
+{
+  /// \brief Scale of the MAD to a normal distribution standard deviation.
+  static const double mad_to_sigma = 1.4826;
+  /// \brief Maximum histogram size, the bins grow for deep clouds.
+  static const std::size_t max_bins = 4096;
+
+  /// \brief Upper median, depths are reordered.
+  float median(std::vector<float>& depths)
+  {
+    std::vector<float>::iterator middle = depths.begin() + depths.size() / 2;
+    std::nth_element(depths.begin(), middle, depths.end());
+    return *middle;
+  }
+} // end of anonymous namespace.
+
+depth_filter_t parseDepthFilter(const std::string& filter)
+{
+  if (filter == "mad")
+    return MAD_FILTER;
+  if (filter == "histogram")
+    return HISTOGRAM_FILTER;
+  if (filter != "" && filter != "statistical")
+    ROS_WARN("Unknown depth filter %s, falling back to statistical",
+	     filter.c_str());
+  return STATISTICAL_FILTER;
+}
+
+DepthFilter::DepthFilter()
+  : method_(STATISTICAL_FILTER),
+    madScale_(3.),
+    minSpread_(0.01),
+    binSize_(0.02),
+    gateWidth_(0.15),
+    depths_(),
+    histogram_()
+{}
+
+bool
+DepthFilter::depthRange(float& low, float& high)
+{
+  if (depths_.empty())
+    return false;
+
+  if (method_ == MAD_FILTER)
+    {
+      const float center = median(depths_);
+      for (std::size_t i = 0; i < depths_.size(); ++i)
+	depths_[i] = std::fabs(depths_[i] - center);
+      const double spread =
+	std::max(madScale_ * mad_to_sigma * median(depths_), minSpread_);
+      low = center - spread;
+      high = center + spread;
+      return true;
+    }
+
+  const float minDepth = *std::min_element(depths_.begin(), depths_.end());
+  const float maxDepth = *std::max_element(depths_.begin(), depths_.end());
+  const double bin = resetHistogram(minDepth, maxDepth);
+  const std::size_t bins = histogram_.size();
+  for (std::size_t i = 0; i < depths_.size(); ++i)
+    {
+      std::size_t index = std::size_t((depths_[i] - minDepth) / bin);
+      ++histogram_[std::min(index, bins - 1)];
+    }
+  modeRange(minDepth, bin, low, high);
+  return true;
+}
+
+bool
+DepthFilter::depthRange(const std::vector<float>& depths,
+			const std::vector<unsigned>& counts,
+			float& low, float& high)
+{
+  if (depths.empty())
+    return false;
+
+  if (method_ == MAD_FILTER)
+    {
+      // Weighted upper median, as median.
+      unsigned total = 0;
+      for (std::size_t i = 0; i < counts.size(); ++i)
+	total += counts[i];
+      const unsigned half = total / 2;
+      std::size_t middle = 0;
+      for (unsigned seen = counts[0]; seen <= half; seen += counts[middle])
+	++middle;
+      const float center = depths[middle];
+
+      // Deviations grow away from the median bin, merge both sides.
+      std::size_t below = middle + 1;
+      std::size_t above = middle + 1;
+      float deviation = 0.f;
+      for (unsigned seen = 0; seen <= half; )
+	{
+	  const bool down = above == depths.size()
+	    || (below > 0 && center - depths[below - 1]
+		<= depths[above] - center);
+	  const std::size_t i = down ? --below : above++;
+	  deviation = std::fabs(depths[i] - center);
+	  seen += counts[i];
+	}
+      const double spread =
+	std::max(madScale_ * mad_to_sigma * deviation, minSpread_);
+      low = center - spread;
+      high = center + spread;
+      return true;
+    }
+
+  const double bin = resetHistogram(depths.front(), depths.back());
+  const std::size_t bins = histogram_.size();
+  for (std::size_t i = 0; i < depths.size(); ++i)
+    {
+      std::size_t index = std::size_t((depths[i] - depths.front()) / bin);
+      histogram_[std::min(index, bins - 1)] += counts[i];
+    }
+  modeRange(depths.front(), bin, low, high);
+  return true;
+}
+
+double
+DepthFilter::resetHistogram(float minDepth, float maxDepth)
+{
+  double bin = binSize_;
+  std::size_t bins = std::size_t((maxDepth - minDepth) / bin) + 1;
+  if (bins > max_bins)
+    {
+      bins = max_bins;
+      bin = (maxDepth - minDepth) / (max_bins - 1);
+    }
+  histogram_.assign(bins, 0);
+  return bin;
+}
+
+void
+DepthFilter::modeRange(float minDepth, double bin,
+		       float& low, float& high) const
+{
+  const std::size_t bins = histogram_.size();
+  // Sum over three bins so that a mode split by a bin border wins
+  // over an isolated spike.
+  std::size_t mode = 0;
+  unsigned best = 0;
+  for (std::size_t i = 0; i < bins; ++i)
+    {
+      unsigned count = histogram_[i];
+      if (i > 0)
+	count += histogram_[i - 1];
+      if (i + 1 < bins)
+	count += histogram_[i + 1];
+      if (count > best)
+	{
+	  best = count;
+	  mode = i;
+	}
+    }
+  const double center = minDepth + (mode + .5) * bin;
+  low = center - gateWidth_;
+  high = center + gateWidth_;
+}
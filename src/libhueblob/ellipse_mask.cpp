@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <cmath>
+#include "libhueblob/ellipse_mask.hh"
+
+EllipseMask::EllipseMask()
+  : rect_(),
+    begins_(),
+    ends_(),
+    area_()
+{}
+
+void
+EllipseMask::set(const cv::RotatedRect& rrect, const cv::Rect& rect)
+{
+  rect_ = rect;
+  const int rows = std::max(rect.height, 0);
+  begins_.assign(rows, 0);
+  ends_.assign(rows, 0);
+  area_ = 0;
+
+  const double a = .5 * rrect.size.width;
+  const double b = .5 * rrect.size.height;
+  if (a <= 0. || b <= 0.)
+    return;
+
+  // A pixel (x, y) is inside if u^2 / a^2 + v^2 / b^2 <= 1, where
+  // (u, v) are its coordinates in the ellipse frame:
+  //   u =  dx cos + dy sin
+  //   v = -dx sin + dy cos
+  // with (dx, dy) its offset to the center. For a given row this is
+  // A dx^2 + B dx + C <= 0.
+  const double angle = rrect.angle * CV_PI / 180.;
+  const double c = std::cos(angle);
+  const double s = std::sin(angle);
+  const double ia2 = 1. / (a * a);
+  const double ib2 = 1. / (b * b);
+  const double A = c * c * ia2 + s * s * ib2;
+  const double halfB = c * s * (ia2 - ib2);
+  const double C = s * s * ia2 + c * c * ib2;
+
+  for (int row = 0; row < rows; ++row)
+    {
+      const double dy = rect.y + row - rrect.center.y;
+      const double delta = (halfB * halfB - A * C) * dy * dy + A;
+      if (delta < 0.)
+	continue;
+      const double root = std::sqrt(delta);
+      const double x0 = rrect.center.x - rect.x;
+      const int first = int(std::ceil(x0 + (-halfB * dy - root) / A));
+      const int last = int(std::floor(x0 + (-halfB * dy + root) / A));
+      begins_[row] = std::max(first, 0);
+      ends_[row] = std::max(std::min(last + 1, rect.width), begins_[row]);
+      area_ += ends_[row] - begins_[row];
+    }
+}
+
+const cv::Rect&
+EllipseMask::rect() const
+{
+  return rect_;
+}
+
+std::size_t
+EllipseMask::area() const
+{
+  return area_;
+}
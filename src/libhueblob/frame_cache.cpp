@@ -0,0 +1,31 @@
+#include <opencv2/imgproc/imgproc.hpp>
+#include "libhueblob/frame_cache.hh"
+
+FrameCache::FrameCache()
+  : entries_(),
+    mutex_()
+{}
+
+cv::Mat
+FrameCache::hsv(const std::string& camera, boost::uint64_t stamp,
+		const cv::Mat& image)
+{
+  boost::shared_ptr<Entry> entry;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    boost::shared_ptr<Entry>& slot = entries_[camera];
+    if (!slot)
+      slot.reset(new Entry());
+    entry = slot;
+  }
+
+  // Objects tracked in the same camera wait for a single conversion.
+  boost::mutex::scoped_lock lock(entry->mutex);
+  if (!entry->valid || entry->stamp != stamp)
+    {
+      cv::cvtColor(image, entry->hsv, CV_BGR2HSV);
+      entry->stamp = stamp;
+      entry->valid = true;
+    }
+  return entry->hsv;
+}
@@ -0,0 +1,101 @@
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <ros/console.h>
+#include "libhueblob/frame_worker.hh"
+
+FrameWorker::FrameWorker()
+  : mutex_(),
+    ready_(),
+    job_(),
+    stop_(false),
+    processed_(),
+    dropped_(),
+    failed_(),
+    thread_()
+{
+  // Started once every member is initialized.
+  thread_ = boost::thread(boost::bind(&FrameWorker::work, this));
+}
+
+FrameWorker::~FrameWorker()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  ready_.notify_all();
+  thread_.join();
+}
+
+void
+FrameWorker::post(const job_t& job)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    if (job_)
+      ++dropped_;
+    job_ = job;
+  }
+  ready_.notify_one();
+}
+
+std::size_t
+FrameWorker::processed() const
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  return processed_;
+}
+
+std::size_t
+FrameWorker::dropped() const
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  return dropped_;
+}
+
+std::size_t
+FrameWorker::failed() const
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  return failed_;
+}
+
+void
+FrameWorker::work()
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (true)
+    {
+      while (!stop_ && !job_)
+	ready_.wait(lock);
+      if (stop_)
+	return;
+
+      // Release the frame before the next one is posted.
+      job_t job;
+      job.swap(job_);
+      bool failed = false;
+
+      lock.unlock();
+      try
+	{
+	  job();
+	}
+      catch (const std::exception& e)
+	{
+	  ROS_ERROR("frame processing failed: %s", e.what());
+	  failed = true;
+	}
+      catch (...)
+	{
+	  ROS_ERROR("frame processing failed: unknown exception");
+	  failed = true;
+	}
+      job = job_t();
+      lock.lock();
+
+      ++processed_;
+      if (failed)
+	++failed_;
+    }
+}
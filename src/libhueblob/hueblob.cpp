@@ -30,19 +30,64 @@
 
 #include <yaml-cpp/yaml.h>
 
+#include "libhueblob/model_cache.hh"
+#include "libhueblob/yaml_model.hh"
+
 void nullDeleter(void*) {}
 void nullDeleterConst(const void*) {}
 
-struct YamlModel {
-  std::string name;
-  std::string path;
-};
-
-void operator >> (const YAML::Node& node, YamlModel& model) {
-   node["name"] >> model.name;
-   node["path"] >> model.path;
-}
-
+namespace
+{
+  /// \brief Result of a model loading task.
+  struct LoadedModel
+  {
+    LoadedModel() : model(), loaded(false), cached(false), duration() {}
+    Object model;
+    bool loaded;
+    bool cached;
+    /// \brief Loading time, in seconds.
+    double duration;
+  };
+
+  /// \brief Timed node stages, see HueBlob::latencyStages_.
+  enum
+  {
+    CONVERT_LATENCY,
+    TRACK_LATENCY,
+    PROJECT_LATENCY,
+    PUBLISH_LATENCY,
+    GET3D_CLOUD_LATENCY,
+    STATISTICS_LATENCY,
+    SOR_LATENCY,
+    DEPTH_FILTER_LATENCY,
+    END_TO_END_LATENCY,
+    LATENCY_STAGES
+  };
+  static const char* const latency_names[LATENCY_STAGES] =
+    {"convert", "track", "project", "publish", "get3d_cloud", "statistics",
+     "sor", "depth_filter", "end_to_end"};
+
+  /// \brief Compile one model, or copy it from the cache.
+  void loadModel(const YamlModel& yaml_model, const CachedModel* cache,
+                 LoadedModel& loaded)
+  {
+    ros::WallTime start = ros::WallTime::now();
+    if (cache)
+      {
+        loaded.model.copyModel(cache->object);
+        loaded.cached = true;
+      }
+    else
+      {
+        cv::Mat view = cv::imread(yaml_model.path);
+        if (!view.data)
+          return;
+        loaded.model.addView(view);
+      }
+    loaded.loaded = true;
+    loaded.duration = (ros::WallTime::now() - start).toSec();
+  }
+} // end of anonymous namespace.
 
 HueBlob::HueBlob()
   : nh_("hueblob"),
@@ -50,31 +95,106 @@ HueBlob::HueBlob()
     stereo_topic_prefix_ (),
     threshold_(),
     bridgeLeft_(),
+    bridgeRight_(),
     bridgeDisparity_(),
     left_sub_(),
     right_sub_(),
     disparity_sub_(),
     exact_sync_(3),
     approximate_sync_(100),
-    left_objects_(),
-    right_objects_(),
+    latency_(),
+    latencyStages_(),
+    objects_(),
+    tracking_(),
+    projection_(),
+    frame_mutex_(),
+    frameCache_(),
+    single_pass_(),
+    labeled_(),
+    left_labels_(),
+    right_labels_(),
+    object_labels_(),
     check_synced_timer_(),
+    report_frames_timer_(),
+    reported_dropped_(),
     left_received_(),
     right_received_(),
     disp_received_(),
     all_received_(),
-    leftImage_(),
-    rightImage_(),
-    leftCamera_(),
-    disparity_(),
-    preload_models_()
+    algo_(),
+    preload_models_(),
+    model_cache_(),
+    roi_gating_(),
+    roi_margin_(),
+    reacquire_period_(),
+    integral_camshift_(),
+    integral_second_order_(),
+    epipolar_constraint_(),
+    epipolar_margin_(),
+    depthFilter_(),
+    workers_(),
+    frameWorker_(),
+    projectors_(),
+    pipeline_()
 {
   // Parameter initialization.
   ros::param::param<std::string>("~stereo", stereo_topic_prefix_, "");
   ros::param::param<std::string>("~frame", frame_, "camera_bottom_left_optical");
   ros::param::param<std::string>("~models", preload_models_, "");
+  ros::param::param<std::string>("~model_cache", model_cache_, "");
   ros::param::param<bool>("~approximate_sync", is_approximate_sync_, false);
   ros::param::param<double>("threshold", threshold_, 75.);
+  ros::param::param<bool>("~single_pass", single_pass_, false);
+  ros::param::param<std::string>("~algo", algo_, "camshift");
+  ros::param::param<bool>("~roi_gating", roi_gating_, false);
+  ros::param::param<int>("~roi_margin", roi_margin_, 32);
+  ros::param::param<int>("~reacquire_period", reacquire_period_, 30);
+  ros::param::param<bool>("~integral_camshift", integral_camshift_, false);
+  ros::param::param<bool>("~integral_second_order", integral_second_order_,
+                          false);
+  ros::param::param<bool>("~epipolar_constraint", epipolar_constraint_, true);
+  ros::param::param<int>("~epipolar_margin", epipolar_margin_, 10);
+  // Not validated on recorded bags yet, see the README.
+  std::string depth_filter;
+  ros::param::param<std::string>("~depth_filter", depth_filter,
+                                 "statistical");
+  depthFilter_.method_ = parseDepthFilter(depth_filter);
+  ros::param::param<double>("~mad_scale", depthFilter_.madScale_,
+                            depthFilter_.madScale_);
+  ros::param::param<double>("~depth_bin", depthFilter_.binSize_,
+                            depthFilter_.binSize_);
+  ros::param::param<double>("~depth_gate", depthFilter_.gateWidth_,
+                            depthFilter_.gateWidth_);
+  int threads;
+  ros::param::param<int>("~threads", threads, 1);
+  workers_.reset(new WorkerPool(std::max(threads, 1)));
+  bool latest_frame, pipeline;
+  int pipeline_queue;
+  ros::param::param<bool>("~latest_frame", latest_frame, false);
+  ros::param::param<bool>("~pipeline", pipeline, false);
+  ros::param::param<int>("~pipeline_queue", pipeline_queue, 2);
+  if (pipeline)
+    {
+      // Frames are pushed as long as the first stage keeps up, the
+      // subscriber queues drop the oldest ones otherwise.
+      if (latest_frame)
+	ROS_WARN("~latest_frame is ignored when ~pipeline is set");
+      std::vector<Pipeline<frame_t>::stage_t> stages;
+      stages.push_back(boost::bind(&HueBlob::convertFrame, this, _1));
+      stages.push_back(boost::bind(&HueBlob::trackFrame, this, _1));
+      stages.push_back(boost::bind(&HueBlob::projectFrame, this, _1));
+      stages.push_back(boost::bind(&HueBlob::publishFrame, this, _1));
+      projectors_.reset(new WorkerPool(std::max(threads, 1)));
+      pipeline_.reset(new Pipeline<frame_t>(stages,
+					     std::max(pipeline_queue, 1)));
+    }
+  else if (latest_frame)
+    {
+      frameWorker_.reset(new FrameWorker());
+      report_frames_timer_ =
+	nh_.createWallTimer(ros::WallDuration(30.0),
+			    boost::bind(&HueBlob::reportFrames, this));
+    }
 
   const std::string tracked_image_topic =
     ros::names::append("/hueblob/", stereo_topic_prefix_ + "/tracked/image_rect_color");
@@ -88,6 +208,15 @@ HueBlob::HueBlob()
     ros::names::append("/hueblob/", stereo_topic_prefix_ + "/blobs/count");
   count_pub_ = nh_.advertise<std_msgs::Int8>(count_topic, 5);
 
+  const std::string latency_topic =
+    ros::names::append("/hueblob/", stereo_topic_prefix_ + "/latency");
+  latency_pub_ = nh_.advertise<hueblob::LatencyStats>(latency_topic, 1);
+  latency_timer_ =
+    nh_.createWallTimer(ros::WallDuration(1.0),
+			boost::bind(&HueBlob::publishLatency, this));
+  for (int stage = 0; stage < LATENCY_STAGES; ++stage)
+    latencyStages_.push_back(latency_.stage(latency_names[stage]));
+
   const std::string points2_topic =
     ros::names::append("/hueblob/", stereo_topic_prefix_ + "/points2");
   cloud_pub_  = nh_.advertise<pcl::PointCloud<pcl::PointXYZ> > (points2_topic, 1);
@@ -123,7 +252,7 @@ HueBlob::~HueBlob()
 }
 
 void
-HueBlob::publish_tracked_images(hueblob::Blobs blobs)
+HueBlob::publish_tracked_images(const Frame& frame, hueblob::Blobs blobs)
 {
   //ROS_DEBUG_THROTTLE(1, "publish_track_cb");
   // static const std::string tracked_image_topic =
@@ -138,10 +267,12 @@ HueBlob::publish_tracked_images(hueblob::Blobs blobs)
   for (  std::vector<hueblob::Blob>::iterator iter= blobs.blobs.begin();
          iter != blobs.blobs.end(); iter++ )
     {
-      if (!leftImage_ || !rightImage_)
+      if (!frame.leftBgr)
         break;
+      // Draw on a copy, the frame image is shared with the message.
+      if (!tracked)
+        img = frame.leftBgr->image.clone();
       tracked = true;
-      img = bridgeLeft_.imgMsgToCv(leftImage_, "bgr8");
       int x =  (*iter).boundingbox_2d[0];
       int y =  (*iter).boundingbox_2d[1];
       int width =  (*iter).boundingbox_2d[2];
@@ -159,15 +290,15 @@ HueBlob::publish_tracked_images(hueblob::Blobs blobs)
 
     }
 
-  if (leftImage_ && tracked){
+  if (frame.left && tracked){
     cv_bridge::CvImage brd_im;
     brd_im.image = img;
-    brd_im.header = leftImage_->header;
+    brd_im.header = frame.left->header;
     brd_im.encoding = sensor_msgs::image_encodings::TYPE_8UC3;
     tracked_left_pub_.publish(brd_im.toImageMsg());
   }
   else
-    ROS_WARN_THROTTLE(20,"leftImage_ is not received");
+    ROS_WARN_THROTTLE(20,"left image is not received");
 
 }
 
@@ -266,36 +397,85 @@ HueBlob::setupInfrastructure(const std::string& stereo_prefix)
     {
     try
       {
-        std::ifstream fin(preload_models_.c_str());
-        YAML::Parser parser(fin);
-        YAML::Node doc;
-        parser.GetNextDocument(doc);
-        for(unsigned i=0;i<doc.size();i++) {
-          YamlModel yaml_model;
-          doc[i] >> yaml_model;
-          ROS_INFO_STREAM("Adding "<< yaml_model.name << " " << yaml_model.path);
-            // Get reference on the object.
-
-          Object& left_object = left_objects_[yaml_model.name];
-          Object& right_object = right_objects_[yaml_model.name];
+        std::vector<YamlModel> yaml_models = readYamlModels(preload_models_);
+
+        // Use the precompiled models when the cache is up to date.
+        std::vector<CachedModel> cached;
+        if (model_cache_ != "")
+          {
+            std::vector<std::string> sources(1, preload_models_);
+            BOOST_FOREACH(const YamlModel& yaml_model, yaml_models)
+              sources.push_back(yaml_model.path);
+            if (!modelCacheFresh(model_cache_, sources)
+                || !loadModelCache(model_cache_, cached))
+              ROS_WARN("Model cache %s is missing or stale, run compile_models",
+                       model_cache_.c_str());
+          }
+
+        // Decode the images and compile the models concurrently.
+        ros::WallTime start = ros::WallTime::now();
+        std::vector<LoadedModel> loaded(yaml_models.size());
+        std::vector<WorkerPool::task_t> tasks;
+        for (unsigned i = 0; i < yaml_models.size(); ++i)
+          {
+            const CachedModel* cache =
+              findCachedModel(cached, yaml_models[i].name,
+                              yaml_models[i].path);
+            tasks.push_back(boost::bind(&loadModel,
+                                        boost::cref(yaml_models[i]), cache,
+                                        boost::ref(loaded[i])));
+          }
+        int load_threads;
+        ros::param::param<int>("~load_threads", load_threads,
+                               boost::thread::hardware_concurrency());
+        WorkerPool loaders(std::max(load_threads, 1));
+        loaders.run(tasks);
+
+        // Then publish all of them at once.
+        ObjectRegistry::snapshot_t current = objects_.snapshot();
+        ObjectRegistry::models_t models;
+        std::size_t failed = 0;
+        for (unsigned i = 0; i < yaml_models.size(); ++i)
+        {
+          const YamlModel& yaml_model = yaml_models[i];
+          if (!loaded[i].loaded)
+            {
+              ++failed;
+              ROS_ERROR("Failed to load %s from %s", yaml_model.name.c_str(),
+                        yaml_model.path.c_str());
+              continue;
+            }
+          ROS_INFO("Added %s from %s in %.1f ms%s", yaml_model.name.c_str(),
+                   yaml_model.path.c_str(), loaded[i].duration * 1e3,
+                   loaded[i].cached ? " (cached)" : "");
+
           const std::string blob_topic =
             ros::names::append("/hueblob/", stereo_topic_prefix_ + "/blobs/" + yaml_model.name);
 
           blob_pubs_[yaml_model.name] = nh_.advertise<hueblob::Blob>(blob_topic, 5);
 
           // Emit a warning if the object already exists.
-          if (left_object.anchor_x_
-              || left_object.anchor_y_
-              || left_object.anchor_z_)
+          if (current->count(yaml_model.name) || models.count(yaml_model.name))
             ROS_WARN("Overwriting the object %s", yaml_model.name.c_str());
-          cv::Mat model = cv::imread(yaml_model.path);
-          // Add the view to the object.
-          left_object.addView(model);
-          // Add the view to the object.
-          right_object.addView(model);
+          boost::shared_ptr<Object> object(new Object());
+          object->lookup_ = parseLookup(yaml_model.lookup);
+          object->pyramidLevels_ = yaml_model.pyramid_levels;
+          setupTracking(*object);
+          if (!yaml_model.algo.empty())
+            object->algo_ = parseAlgo(yaml_model.algo);
+          object->copyModel(loaded[i].model);
+          models[yaml_model.name] = object;
         }
+        objects_.insert(models);
+        ROS_INFO("Loaded %u models (%u failed) in %.1f ms using %u threads",
+                 unsigned(models.size()), unsigned(failed),
+                 (ros::WallTime::now() - start).toSec() * 1e3,
+                 loaders.size());
+      }
+      catch(YAML::Exception& e) {
+        ROS_FATAL_STREAM(e.what());
       }
-      catch(YAML::ParserException& e) {
+      catch(std::runtime_error& e) {
         ROS_FATAL_STREAM(e.what());
       }
 
@@ -312,25 +492,186 @@ HueBlob::imageCallback(const sensor_msgs::ImageConstPtr& left,
 		       const sensor_msgs::CameraInfoConstPtr& right_camera,
 		       const stereo_msgs::DisparityImageConstPtr& disparity)
 {
-  leftImage_ = left;
-  rightImage_ = right;
-  leftCamera_ = left_camera;
-  disparity_ = disparity;
-  typedef std::pair<const std::string&, const Object&> iterator_t;
+  frame_t frame(new Frame());
+  frame->left = left;
+  frame->leftCamera = left_camera;
+  frame->right = right;
+  frame->disparity = disparity;
+
+  // Fresh results matter more than processing every frame: the worker
+  // drops the frames arriving while one is processed.
+  if (pipeline_)
+    pipeline_->push(frame);
+  else if (frameWorker_)
+    frameWorker_->post(boost::bind(&HueBlob::processFrame, this, frame));
+  else
+    processFrame(frame);
+}
+
+void
+HueBlob::processFrame(frame_t frame)
+{
+  // Object database changes never wait for this lock, only
+  // concurrent frames do.
+  boost::mutex::scoped_lock lock(frame_mutex_);
+  convertFrame(frame);
+  trackFrame(frame);
+  projectFrame(frame);
+  publishFrame(frame);
+}
+
+void
+HueBlob::convertFrame(frame_t& frame)
+{
+  LatencyMonitor::Scope timing(latencyStages_[CONVERT_LATENCY]);
+  namespace enc = sensor_msgs::image_encodings;
+  frame->leftBgr = cv_bridge::toCvShare(frame->left, enc::BGR8);
+  frame->rightBgr = cv_bridge::toCvShare(frame->right, enc::BGR8);
+}
+
+void
+HueBlob::trackFrame(frame_t& frame)
+{
+  LatencyMonitor::Scope timing(latencyStages_[TRACK_LATENCY]);
+  frame->objects = objects_.snapshot();
+  updateTracking(frame->objects);
+  if (single_pass_)
+    labelFrames(*frame);
+
+  std::vector<BlobTrack>& tracks = frame->tracks;
+  tracks.reserve(tracking_.size());
+  typedef std::pair<const std::string, TrackingState> value_t;
+  BOOST_FOREACH(value_t& it, tracking_)
+    tracks.push_back(BlobTrack(it.first, it.second.model,
+                               &it.second.left, &it.second.right));
+
+  // One task per object. Results are gathered in the objects order.
+  std::vector<WorkerPool::task_t> tasks;
+  for (unsigned i = 0; i < tracks.size(); ++i)
+    tasks.push_back(boost::bind(&HueBlob::trackStereo, this,
+                                boost::cref(*frame), boost::ref(tracks[i])));
+  workers_->run(tasks);
+}
+
+void
+HueBlob::projectFrame(frame_t& frame)
+{
+  LatencyMonitor::Scope timing(latencyStages_[PROJECT_LATENCY]);
+  // Projection states follow the objects of the frame, as the
+  // tracking states did in the tracking stage.
+  std::map<std::string, ProjectionState>::iterator stale = projection_.begin();
+  while (stale != projection_.end())
+    if (!frame->objects->count(stale->first))
+      projection_.erase(stale++);
+    else
+      ++stale;
+
+  std::vector<WorkerPool::task_t> tasks;
+  BOOST_FOREACH(BlobTrack& track, frame->tracks)
+    {
+      std::pair<std::map<std::string, ProjectionState>::iterator, bool>
+	state = projection_.insert(std::make_pair(track.name,
+						  ProjectionState()));
+      if (state.second)
+	state.first->second.depthFilter = depthFilter_;
+      tasks.push_back(boost::bind(&HueBlob::projectBlob, this,
+				  boost::cref(*frame), boost::ref(track),
+				  boost::ref(state.first->second)));
+    }
+  // When pipelined, projection has its own threads so that it runs
+  // while the next frame is tracked.
+  (projectors_ ? *projectors_ : *workers_).run(tasks);
+}
+
+void
+HueBlob::publishFrame(frame_t& frame)
+{
+  LatencyMonitor::Scope timing(latencyStages_[PUBLISH_LATENCY]);
   unsigned count(0);
   hueblob::Blobs blobs;
-  BOOST_FOREACH(iterator_t it, left_objects_)
+  BOOST_FOREACH(const BlobTrack& track, frame->tracks)
     {
-      hueblob::Blob blob = trackBlob(it.first);
-      blobs.blobs.push_back(blob);
-      blob_pubs_[blob.name].publish(blob);
+      blobs.blobs.push_back(track.blob);
+      blob_pubs_[track.name].publish(track.blob);
       count++;
     }
   // blobs_pub_.publish(blobs);
   std_msgs::Int8 cnt;
   cnt.data = count;
   count_pub_.publish(cnt);
-  publish_tracked_images(blobs);
+  publish_tracked_images(*frame, blobs);
+  if (latencyStages_[END_TO_END_LATENCY])
+    latencyStages_[END_TO_END_LATENCY]->add
+      ((ros::Time::now() - frame->left->header.stamp).toSec());
+}
+
+void
+HueBlob::updateTracking(const ObjectRegistry::snapshot_t& objects)
+{
+  // Drop removed objects, then restart tracking of new or modified
+  // ones from their model.
+  std::map<std::string, TrackingState>::iterator stale = tracking_.begin();
+  while (stale != tracking_.end())
+    if (!objects->count(stale->first))
+      tracking_.erase(stale++);
+    else
+      ++stale;
+
+  typedef std::pair<const std::string, ObjectRegistry::model_t> value_t;
+  BOOST_FOREACH(const value_t& it, *objects)
+    {
+      TrackingState& state = tracking_[it.first];
+      if (state.model == it.second)
+        continue;
+      state.model = it.second;
+      state.left = *it.second;
+      state.right = *it.second;
+      state.left.setLatency(&latency_);
+      state.right.setLatency(&latency_);
+    }
+}
+
+void
+HueBlob::labelFrames(const Frame& frame)
+{
+  const ObjectRegistry::snapshot_t& objects = frame.objects;
+  if (labeled_ != objects)
+    {
+      // Both cameras share the models, but each engine keeps the
+      // labels of its own frame.
+      std::vector<const Object*> models;
+      object_labels_.clear();
+      typedef std::pair<const std::string, ObjectRegistry::model_t> value_t;
+      BOOST_FOREACH(const value_t& it, *objects)
+        {
+          // Naive objects do not use likelihoods, HSV objects are
+          // not in the engine table.
+          if (!LabelEngine::accepts(*it.second))
+            {
+              if (it.second->lookup_ == HSV_LOOKUP)
+                ROS_WARN_ONCE("Single pass labeling only applies to bgr "
+                              "lookup objects, the hsv ones are tracked "
+                              "one by one");
+              continue;
+            }
+          // Remaining objects are tracked one by one.
+          if (models.size() == LabelEngine::max_objects)
+            {
+              ROS_WARN_ONCE("Too many objects for single pass labeling");
+              break;
+            }
+          object_labels_[it.first] = models.size();
+          models.push_back(it.second.get());
+        }
+      left_labels_.compile(models);
+      right_labels_.compile(models);
+      labeled_ = objects;
+    }
+
+  if (!left_labels_.size())
+    return;
+  left_labels_.label(frame.leftBgr->image);
+  right_labels_.label(frame.rightBgr->image);
 }
 
 bool
@@ -356,38 +697,41 @@ HueBlob::AddObjectCallback(hueblob::AddObject::Request& request,
   cv::Mat model(model_, false);
 
 
-  // Get reference on the object.
-  Object& left_object = left_objects_[request.name];
-  Object& right_object = right_objects_[request.name];
-
   // Emit a warning if the object already exists.
-  if (left_object.anchor_x_
-      || left_object.anchor_y_
-      || left_object.anchor_z_)
+  if (objects_.snapshot()->count(request.name))
     ROS_WARN("Overwriting the object %s", request.name.c_str());
 
-  // Initialize the object.
-  left_object.anchor_x_ = request.anchor.x;
-  left_object.anchor_y_ = request.anchor.y;
-  left_object.anchor_z_ = request.anchor.z;
-  // Add the view to the object.
-  left_object.addView(model);
-
-  right_object.anchor_x_ = request.anchor.x;
-  right_object.anchor_y_ = request.anchor.y;
-  right_object.anchor_z_ = request.anchor.z;
+  // Initialize the object, then publish it: the frame loop keeps
+  // tracking the previous version meanwhile.
+  boost::shared_ptr<Object> object(new Object());
+  setupTracking(*object);
+  object->anchor_x_ = request.anchor.x;
+  object->anchor_y_ = request.anchor.y;
+  object->anchor_z_ = request.anchor.z;
   // Add the view to the object.
-  right_object.addView(model);
+  object->addView(model);
+  objects_.insert(request.name, object);
 
   return true;
 }
 
+void
+HueBlob::setupTracking(Object& object) const
+{
+  object.algo_ = parseAlgo(algo_);
+  object.roiGating_ = roi_gating_;
+  object.roiMargin_ = roi_margin_;
+  object.reacquirePeriod_ = reacquire_period_;
+  object.integralCamShift_ = integral_camshift_;
+  object.integralSecondOrder_ = integral_second_order_;
+}
+
 bool
 HueBlob::ListObjectCallback(hueblob::ListObject::Request& request,
 			    hueblob::ListObject::Response& response)
 {
-  typedef std::pair<const std::string&, const Object&> iterator_t;
-  BOOST_FOREACH(iterator_t it, left_objects_)
+  typedef std::pair<const std::string, ObjectRegistry::model_t> value_t;
+  BOOST_FOREACH(const value_t& it, *objects_.snapshot())
     response.objects.push_back(it.first);
   return true;
 }
@@ -396,8 +740,7 @@ bool
 HueBlob::RmObjectCallback(hueblob::RmObject::Request& request,
 			  hueblob::RmObject::Response& response)
 {
-  left_objects_.erase(request.name);
-  right_objects_.erase(request.name);
+  objects_.erase(request.name);
   return true;
 }
 
@@ -411,65 +754,18 @@ HueBlob::TrackObjectCallback(hueblob::TrackObject::Request& request,
 namespace
 {
 
-  inline void projectTo3d(float u, float v, float disparity,
-                          const stereo_msgs::DisparityImage &disparity_image,
-                          const sensor_msgs::CameraInfo &camera_info,
-                          float &x, float &y, float &z,
-                          bool shift_correction = false)
+  /// \brief Share the data of a 32FC1 disparity image.
+  cv::Mat disparityMat(const stereo_msgs::DisparityImage& disparity_image)
   {
-
-    float fx = camera_info.P[0*4+0];
-    float fy = camera_info.P[1*4+1];
-    float cx = camera_info.P[0*4+2];
-    float cy = camera_info.P[1*4+2];
-    // float Tx = camera_info.P[0*4+3];
-    // float Ty = camera_info.P[1*4+3];
-
-    // if (shift_correction)
-    //   {
-    //     // account for the fact the center point of the image is not the
-    //     // principal point
-    //     // not sure if this is really correct or more of a hack, but
-    //     // without this the image
-    //     // ends up shifted
-    //     u = u - (disparity_image.image.width/2  - cx);
-    //     v = v - (disparity_image.image.height/2 - cy);
-    //   }
-
-    z = disparity_image.f * disparity_image.T / disparity;
-    x = ( (u - cx ) / fx );
-    x*= z;
-    y = ( (v - cy ) / fy );
-    y*= z;
+    const sensor_msgs::Image& image = disparity_image.image;
+    if (image.data.empty())
+      return cv::Mat();
+    return cv::Mat(image.height, image.width, CV_32FC1,
+                   const_cast<unsigned char*>(&image.data[0]), image.step);
   }
 
-  //! Check if a disparity image as a valid value at given image coordinates
-  inline bool hasDisparityValue(const stereo_msgs::DisparityImage
-                                &disparity_image, unsigned int h, unsigned int w)
-  {
-    if (h>= disparity_image.image.height && w >= disparity_image.image.width)
-      return false;
-    float val;
-    memcpy(&val, &(disparity_image.image.data.at(
-                                                 h*disparity_image.image.step
-                                                 + sizeof(float)*w )), sizeof(float));
-    if (std::isnan(val) || std::isinf(val)) return false;
-    if (val < disparity_image.min_disparity || val >
-        disparity_image.max_disparity) return false;
-    return true;
-  }
-  //! Get the value from an image at given image coordinates as a float
-  inline void getPoint(const sensor_msgs::Image &image, unsigned int h,
-                       unsigned int w, float &val)
-  {
-    ROS_ASSERT(h<image.height && w<image.width);
-    memcpy(&val, &(image.data.at( h*image.step + sizeof(float)*w )),
-           sizeof(float));
-  }
-
-
   void get3dCloud(const stereo_msgs::DisparityImage &disparity_image,
-                  const sensor_msgs::CameraInfo &camera_info,
+                  Reprojector& reprojector,
                   cv::Rect& rect,
                   cv::Rect& right_rect,
                   pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_cloud,
@@ -510,76 +806,139 @@ namespace
       {
         //ROS_DEBUG_STREAM(right_center << " " << left_center << " ");
         float disparity = left_center.x - right_center.x;
-        int i = rect.y;
-        int j = rect.x;
-        float x, y, z;
-        projectTo3d(j, i, disparity,  disparity_image,
-                    camera_info, x, y, z, true);
-        center_est.x = x;
-        center_est.y = y;
-        center_est.z = z;
+        center_est = reprojector.point(rect.x, rect.y, disparity);
         // ROS_DEBUG_STREAM(left_center << " "
         //                  << right_center << " "
         //                  << center_est);
       }
-    for (int i = rect.y; i < rect.y + rect.height; ++i)
-      for (int j = rect.x; j < rect.x + rect.width; ++j)
-        {
-          if (!hasDisparityValue(disparity_image, i, j))
-            continue;
-          float disparity, x, y, z;
-          getPoint(disparity_image.image, i, j, disparity);
-          ROS_ASSERT(disparity_image.max_disparity != 0.0);
-          if (disparity == 0)
-            continue;
-          projectTo3d(j, i, disparity,  disparity_image,
-                      camera_info, x, y, z, true);
-          pcl::PointXYZ point(x,y,z);
-          pcl_cloud->points.push_back(point);
-        }
+    ROS_ASSERT(disparity_image.max_disparity != 0.0);
+    if (!pcl_cloud)
+      return;
+    cv::Mat disparity = disparityMat(disparity_image);
+    if (!disparity.empty())
+      reprojector.project(disparity, rect, pcl_cloud->points);
+    pcl_cloud->width = pcl_cloud->points.size();
+    pcl_cloud->height = 1;
   }
 
 } // end of anonymous namespace.
 
-hueblob::Blob
-HueBlob::trackBlob(const std::string& name)
+HueBlob::BlobTrack::BlobTrack(const std::string& name,
+			      const ObjectRegistry::model_t& model,
+			      Object* left, Object* right)
+  : name(name),
+    model(model),
+    left(left),
+    right(right),
+    left_rrect(),
+    right_rrect(),
+    blob()
+{}
+
+void
+HueBlob::trackStereo(const Frame& frame, BlobTrack& track)
+{
+  const cv::Mat& left = frame.leftBgr->image;
+  const cv::Mat& right = frame.rightBgr->image;
+  trackObject(frame, track, false, cv::Rect(0, 0, left.cols, left.rows));
+  if (!epipolar_constraint_)
+    {
+      trackObject(frame, track, true, cv::Rect(0, 0, right.cols, right.rows));
+      return;
+    }
+
+  // A blob seen by the right camera only cannot be projected.
+  if (!track.left_rrect)
+    {
+      track.right_rrect = boost::none;
+      return;
+    }
+  trackObject(frame, track, true,
+	      epipolarArea(frame, track.left_rrect->boundingRect()));
+}
+
+cv::Rect
+HueBlob::epipolarArea(const Frame& frame, const cv::Rect& left) const
+{
+  // Rectified images: the right blob lies on the same rows, shifted
+  // to the left by a disparity within the matcher range.
+  const int min_disparity = cvFloor(frame.disparity->min_disparity);
+  const int max_disparity = cvCeil(frame.disparity->max_disparity);
+  const cv::Mat& right = frame.rightBgr->image;
+  cv::Rect area(left.x - max_disparity,
+                left.y - epipolar_margin_,
+                left.width + max_disparity - min_disparity,
+                left.height + 2 * epipolar_margin_);
+  return area & cv::Rect(0, 0, right.cols, right.rows);
+}
+
+void
+HueBlob::trackObject(const Frame& frame, BlobTrack& track, bool right,
+		     const cv::Rect& area)
 {
-  hueblob::Blob blob;
+  Object& object = right ? *track.right : *track.left;
+  const cv::Mat& image = right ? frame.rightBgr->image : frame.leftBgr->image;
+  boost::optional<cv::RotatedRect>& rrect =
+    right ? track.right_rrect : track.left_rrect;
+
+  std::map<std::string, unsigned char>::const_iterator label =
+    object_labels_.find(track.name);
+  if (single_pass_ && label != object_labels_.end())
+    rrect = object.track(right ? right_labels_ : left_labels_,
+			 label->second, area);
+  else
+    {
+      // The frame is only converted once for the objects reading all of
+      // it, the others convert their region themselves.
+      const sensor_msgs::ImageConstPtr& msg = right ? frame.right : frame.left;
+      cv::Mat hsv;
+      if (object.readsAreaHsv()
+	  && area == cv::Rect(0, 0, image.cols, image.rows))
+	hsv = frameCache_.hsv(right ? "right" : "left",
+			      msg->header.stamp.toNSec(), image);
+      rrect = object.track(image, hsv, area);
+    }
+}
+
+void
+HueBlob::projectBlob(const Frame& frame, BlobTrack& track,
+		     ProjectionState& state)
+{
+  const std::string& name = track.name;
+  hueblob::Blob& blob = track.blob;
+  const sensor_msgs::ImageConstPtr& leftImage = frame.left;
+  const stereo_msgs::DisparityImageConstPtr& disparity_image = frame.disparity;
   // Image acquisition.
-  if (!leftImage_ || !disparity_ || !rightImage_)
+  if (!leftImage || !disparity_image || !frame.right)
     {
-      ROS_WARN_STREAM_THROTTLE(1, "At least one of leftImage_ || disparity_ "
-                               "|| rightImage_ is missing. Aborting tracking"
-                               << leftImage_ << " " << rightImage_ << " "
-                               << disparity_);
-      return blob;
+      ROS_WARN_STREAM_THROTTLE(1, "At least one of left image || disparity "
+                               "|| right image is missing. Aborting tracking"
+                               << leftImage << " " << frame.right << " "
+                               << disparity_image);
+      return;
     }
   // Fill blob header.
   blob.name = name;
-  blob.header = leftImage_->header;
-  blob.position.header = leftImage_->header;
+  blob.header = leftImage->header;
+  blob.position.header = leftImage->header;
   blob.position.child_frame_id = "/hueblob_" + name;
   blob.boundingbox_2d.resize(4);
   for (unsigned i = 0; i < 4; ++i)
     blob.boundingbox_2d[i] = 0.;
 
-  // Realize 2d tracking in the image.
-  Object& robject = right_objects_[name];
-  // get box for right image
-  cv::Mat right_image(bridgeLeft_.imgMsgToCv(rightImage_, "bgr8"), false);
-  boost::optional<cv::RotatedRect> right_rrect = robject.track(right_image);
-
-  Object& object = left_objects_[name];
-  cv::Mat image(bridgeLeft_.imgMsgToCv(leftImage_, "bgr8"), false);
-  boost::optional<cv::RotatedRect> rrect = object.track(image);
+  const Object& object = *track.model;
+  const boost::optional<cv::RotatedRect>& rrect = track.left_rrect;
+  const boost::optional<cv::RotatedRect>& right_rrect = track.right_rrect;
   if (!rrect)
     {
       ROS_WARN_THROTTLE(20, "failed to track object");
-      return blob;
+      return;
     }
 
   cv::Rect rect = rrect->boundingRect();
-  cv::Rect right_rect = right_rrect->boundingRect();
+  cv::Rect right_rect;
+  if (right_rrect)
+    right_rect = right_rrect->boundingRect();
 
   blob.boundingbox_2d[0] = rect.x;
   blob.boundingbox_2d[1] = rect.y;
@@ -590,34 +949,89 @@ HueBlob::trackBlob(const std::string& name)
     {
       ROS_WARN_THROTTLE
         (20, "failed to track object (invalid tracking window)");
-      return blob;
+      return;
     }
 
   cv::Point3d center;
   // static pcl_visualization::CloudViewer viewer("Simple Cloud Viewer");
-  pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_cloud(new pcl::PointCloud<pcl::PointXYZ>);
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_filtered (new pcl::PointCloud<pcl::PointXYZ>);
+  // Clouds are only built for the cloud topic subscribers: SOR needs
+  // them, the streaming statistics use the histogram filter instead.
+  const bool materialize = cloud_pub_.getNumSubscribers() != 0;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_cloud;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_filtered;
+  if (materialize)
+    {
+      pcl_cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+      cloud_filtered.reset(new pcl::PointCloud<pcl::PointXYZ>);
+    }
   cv::Point3f center_est;
-  get3dCloud(*disparity_, *leftCamera_,
-             rect, right_rect,
-             pcl_cloud, center_est);
+  // Only rebuilds the ray tables when the camera changes.
+  const sensor_msgs::CameraInfo& camera = *frame.leftCamera;
+  state.reprojector.setCamera(camera.P[0 * 4 + 0], camera.P[1 * 4 + 1],
+                              camera.P[0 * 4 + 2], camera.P[1 * 4 + 2],
+                              disparity_image->image.width,
+                              disparity_image->image.height);
+  state.reprojector.setDisparity(disparity_image->f * disparity_image->T,
+                                 disparity_image->min_disparity,
+                                 disparity_image->max_disparity);
+  {
+    LatencyMonitor::Scope timing(latencyStages_[GET3D_CLOUD_LATENCY]);
+    get3dCloud(*disparity_image, state.reprojector,
+               rect, right_rect,
+               pcl_cloud, center_est);
+  }
   // std::cerr << "Cloud before filtering: " << std::endl;
   // std::cerr << *pcl_cloud << std::endl;
-  float depth_density = 1.*pcl_cloud->points.size()/(rect.width*rect.height);
 
   Eigen::Vector4f centroid (0., 0., 0., 0.);
   Eigen::Vector4f min3d (0., 0., 0., 0.);
   Eigen::Vector4f max3d (0., 0., 0., 0.);
-  if (pcl_cloud->points.size() >0)
+  float depth_density = 0.;
+  if (!materialize)
     {
+      // Same points and filter as the cloud, see BlobStatistics.
+      LatencyMonitor::Scope timing(latencyStages_[STATISTICS_LATENCY]);
+      BlobStatistics& statistics = state.statistics;
+      statistics.reset();
+      cv::Mat disparity = disparityMat(*disparity_image);
+      if (!disparity.empty())
+        statistics.add(state.reprojector, disparity, rect);
+      depth_density = 1.*statistics.points()/(rect.width*rect.height);
+      if (statistics.compute(state.depthFilter))
+        {
+          centroid << statistics.centroid_.x, statistics.centroid_.y,
+            statistics.centroid_.z, 0.;
+          blob.boundingbox_3d[0] = statistics.min_.x;
+          blob.boundingbox_3d[1] = statistics.min_.y;
+          blob.boundingbox_3d[2] = statistics.min_.z;
+          blob.boundingbox_3d[3] = statistics.max_.x;
+          blob.boundingbox_3d[4] = statistics.max_.y;
+          blob.boundingbox_3d[5] = statistics.max_.z;
+        }
+    }
+  else if (pcl_cloud->points.size() >0)
+    {
+      depth_density = 1.*pcl_cloud->points.size()/(rect.width*rect.height);
       //cloud_pub_.publish(pcl_cloud);
-      pcl::StatisticalOutlierRemoval<pcl::PointXYZ> sor;
-      sor.setInputCloud (pcl_cloud);
-      sor.setMeanK (50);
-      sor.setStddevMulThresh (1.0);
-      sor.filter (*cloud_filtered);
+      DepthFilter& filter = state.depthFilter;
+      if (filter.method_ == STATISTICAL_FILTER)
+        {
+          LatencyMonitor::Scope timing(latencyStages_[SOR_LATENCY]);
+          pcl::StatisticalOutlierRemoval<pcl::PointXYZ> sor;
+          sor.setInputCloud (pcl_cloud);
+          sor.setMeanK (50);
+          sor.setStddevMulThresh (1.0);
+          sor.filter (*cloud_filtered);
+        }
+      else
+        {
+          LatencyMonitor::Scope timing(latencyStages_[DEPTH_FILTER_LATENCY]);
+          filter.filter(pcl_cloud->points);
+          pcl_cloud->width = pcl_cloud->points.size();
+          cloud_filtered = pcl_cloud;
+        }
       cloud_filtered->header.frame_id = frame_;
-      cloud_filtered->header.stamp = leftImage_->header.stamp;
+      cloud_filtered->header.stamp = leftImage->header.stamp;
       pcl::compute3DCentroid(*cloud_filtered, centroid);
       pcl::getMinMax3D(*cloud_filtered, min3d, max3d);
       cloud_pub_.publish(cloud_filtered);
@@ -646,7 +1060,7 @@ HueBlob::trackBlob(const std::string& name)
   blob.cloud_centroid.transform.rotation.y = 0.;
   blob.cloud_centroid.transform.rotation.z = 0.;
   blob.cloud_centroid.transform.rotation.w = 1.;
-  blob.cloud_centroid.header.stamp = leftImage_->header.stamp;
+  blob.cloud_centroid.header.stamp = leftImage->header.stamp;
 
   blob.position.transform.translation.x = center_est.x;
   blob.position.transform.translation.y = center_est.y;
@@ -655,11 +1069,10 @@ HueBlob::trackBlob(const std::string& name)
   blob.position.transform.rotation.y = 0.;
   blob.position.transform.rotation.z = 0.;
   blob.position.transform.rotation.w = 1.;
-  blob.position.header.stamp = leftImage_->header.stamp;
+  blob.position.header.stamp = leftImage->header.stamp;
 
 
   blob.depth_density = depth_density;
-  return blob;
 }
 
 void
@@ -684,3 +1097,29 @@ HueBlob::checkInputsSynchronized()
 	 left_received_, right_received_, disp_received_, all_received_);
     }
 }
+
+void
+HueBlob::reportFrames()
+{
+  const std::size_t dropped = frameWorker_->dropped();
+  if (dropped != reported_dropped_)
+    ROS_INFO_STREAM("[hueblob] Frames processed: " << frameWorker_->processed()
+		    << ", dropped: " << dropped << " ("
+		    << dropped - reported_dropped_
+		    << " since the last report)");
+  else
+    ROS_DEBUG_STREAM("[hueblob] Frames processed: "
+		     << frameWorker_->processed() << ", dropped: " << dropped);
+  reported_dropped_ = dropped;
+}
+
+void
+HueBlob::publishLatency()
+{
+  if (latency_pub_.getNumSubscribers() == 0)
+    return;
+  hueblob::LatencyStats stats;
+  stats.header.stamp = ros::Time::now();
+  latency_.toMessage(stats);
+  latency_pub_.publish(stats);
+}
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "libhueblob/integral_camshift.hh"
+
+namespace
+{
+  /// \brief Size increase of the window before computing its shape.
+  static const int tolerance = 10;
+
+  /// \brief Workspace slots.
+  enum
+  {
+    SUM_TABLE,
+    SUM_X_TABLE,
+    SUM_Y_TABLE,
+    SUM_XX_TABLE,
+    SUM_XY_TABLE,
+    SUM_YY_TABLE
+  };
+} // end of anonymous namespace.
+
+IntegralCamShift::IntegralCamShift()
+  : probability_(),
+    sum_(),
+    sumX_(),
+    sumY_(),
+    sumXX_(),
+    sumXY_(),
+    sumYY_(),
+    secondOrder_(false),
+    workspace_()
+{}
+
+void
+IntegralCamShift::setImage(const cv::Mat& probability, bool secondOrder)
+{
+  CV_Assert(probability.type() == CV_8UC1);
+  probability_ = probability;
+  secondOrder_ = secondOrder;
+
+  cv::Size size(probability.cols + 1, probability.rows + 1);
+  sum_ = workspace_.buffer(SUM_TABLE, size, CV_64F);
+  sumX_ = workspace_.buffer(SUM_X_TABLE, size, CV_64F);
+  sumY_ = workspace_.buffer(SUM_Y_TABLE, size, CV_64F);
+  std::fill(sum_.ptr<double>(0), sum_.ptr<double>(0) + size.width, 0.);
+  std::fill(sumX_.ptr<double>(0), sumX_.ptr<double>(0) + size.width, 0.);
+  std::fill(sumY_.ptr<double>(0), sumY_.ptr<double>(0) + size.width, 0.);
+  if (secondOrder)
+    {
+      sumXX_ = workspace_.buffer(SUM_XX_TABLE, size, CV_64F);
+      sumXY_ = workspace_.buffer(SUM_XY_TABLE, size, CV_64F);
+      sumYY_ = workspace_.buffer(SUM_YY_TABLE, size, CV_64F);
+      std::fill(sumXX_.ptr<double>(0), sumXX_.ptr<double>(0) + size.width, 0.);
+      std::fill(sumXY_.ptr<double>(0), sumXY_.ptr<double>(0) + size.width, 0.);
+      std::fill(sumYY_.ptr<double>(0), sumYY_.ptr<double>(0) + size.width, 0.);
+    }
+
+  // Table (i + 1, j + 1) holds the moments of the pixels (0..i, 0..j):
+  // accumulate each row and add the previous table row.
+  for (int i = 0; i < probability.rows; ++i)
+    {
+      const unsigned char* p = probability.ptr<unsigned char>(i);
+      const double y = i;
+      double s = 0., sx = 0., sy = 0., sxx = 0., sxy = 0., syy = 0.;
+
+      const double* above = sum_.ptr<double>(i);
+      const double* aboveX = sumX_.ptr<double>(i);
+      const double* aboveY = sumY_.ptr<double>(i);
+      double* row = sum_.ptr<double>(i + 1);
+      double* rowX = sumX_.ptr<double>(i + 1);
+      double* rowY = sumY_.ptr<double>(i + 1);
+      row[0] = rowX[0] = rowY[0] = 0.;
+
+      if (!secondOrder)
+	{
+	  for (int j = 0; j < probability.cols; ++j)
+	    {
+	      const double v = p[j];
+	      s += v;
+	      sx += j * v;
+	      sy += y * v;
+	      row[j + 1] = above[j + 1] + s;
+	      rowX[j + 1] = aboveX[j + 1] + sx;
+	      rowY[j + 1] = aboveY[j + 1] + sy;
+	    }
+	  continue;
+	}
+
+      const double* aboveXX = sumXX_.ptr<double>(i);
+      const double* aboveXY = sumXY_.ptr<double>(i);
+      const double* aboveYY = sumYY_.ptr<double>(i);
+      double* rowXX = sumXX_.ptr<double>(i + 1);
+      double* rowXY = sumXY_.ptr<double>(i + 1);
+      double* rowYY = sumYY_.ptr<double>(i + 1);
+      rowXX[0] = rowXY[0] = rowYY[0] = 0.;
+      for (int j = 0; j < probability.cols; ++j)
+	{
+	  const double v = p[j];
+	  const double xv = j * v;
+	  s += v;
+	  sx += xv;
+	  sy += y * v;
+	  sxx += j * xv;
+	  sxy += y * xv;
+	  syy += y * y * v;
+	  row[j + 1] = above[j + 1] + s;
+	  rowX[j + 1] = aboveX[j + 1] + sx;
+	  rowY[j + 1] = aboveY[j + 1] + sy;
+	  rowXX[j + 1] = aboveXX[j + 1] + sxx;
+	  rowXY[j + 1] = aboveXY[j + 1] + sxy;
+	  rowYY[j + 1] = aboveYY[j + 1] + syy;
+	}
+    }
+}
+
+double
+IntegralCamShift::sum(const cv::Mat& table, const cv::Rect& window)
+{
+  const double* top = table.ptr<double>(window.y);
+  const double* bottom = table.ptr<double>(window.y + window.height);
+  int left = window.x;
+  int right = window.x + window.width;
+  return bottom[right] - bottom[left] - top[right] + top[left];
+}
+
+IntegralCamShift::Moments
+IntegralCamShift::firstOrder(const cv::Rect& window) const
+{
+  Moments m;
+  m.m00 = sum(sum_, window);
+  m.m10 = sum(sumX_, window) - window.x * m.m00;
+  m.m01 = sum(sumY_, window) - window.y * m.m00;
+  m.mu20 = m.mu11 = m.mu02 = 0.;
+  return m;
+}
+
+IntegralCamShift::Moments
+IntegralCamShift::moments(const cv::Rect& window) const
+{
+  if (!secondOrder_)
+    {
+      cv::Moments cm = cv::moments(probability_(window));
+      Moments m;
+      m.m00 = cm.m00;
+      m.m10 = cm.m10;
+      m.m01 = cm.m01;
+      m.mu20 = cm.mu20;
+      m.mu11 = cm.mu11;
+      m.mu02 = cm.mu02;
+      return m;
+    }
+
+  Moments m = firstOrder(window);
+  if (std::fabs(m.m00) < DBL_EPSILON)
+    return m;
+
+  // Central moments are translation invariant: compute them from the
+  // image coordinates sums.
+  double s = m.m00;
+  double sx = sum(sumX_, window);
+  double sy = sum(sumY_, window);
+  m.mu20 = sum(sumXX_, window) - sx * sx / s;
+  m.mu11 = sum(sumXY_, window) - sx * sy / s;
+  m.mu02 = sum(sumYY_, window) - sy * sy / s;
+  return m;
+}
+
+cv::RotatedRect
+IntegralCamShift::operator()(cv::Rect& window,
+			     const cv::TermCriteria& criteria) const
+{
+  const cv::Size size = probability_.size();
+
+  double eps = (criteria.type & cv::TermCriteria::EPS)
+    ? std::max(criteria.epsilon, 0.) : 1.;
+  eps = cvRound(eps * eps);
+  int niters = (criteria.type & cv::TermCriteria::MAX_ITER)
+    ? std::max(criteria.maxCount, 1) : 100;
+
+  // Mean shift, constant time per iteration.
+  cv::Rect cur = window;
+  for (int i = 0; i < niters; ++i)
+    {
+      cur &= cv::Rect(0, 0, size.width, size.height);
+      if (cur == cv::Rect())
+	{
+	  cur.x = size.width / 2;
+	  cur.y = size.height / 2;
+	}
+      cur.width = std::max(cur.width, 1);
+      cur.height = std::max(cur.height, 1);
+
+      Moments m = firstOrder(cur);
+      if (std::fabs(m.m00) < DBL_EPSILON)
+	break;
+
+      int dx = cvRound(m.m10 / m.m00 - window.width * 0.5);
+      int dy = cvRound(m.m01 / m.m00 - window.height * 0.5);
+      int nx = std::min(std::max(cur.x + dx, 0), size.width - cur.width);
+      int ny = std::min(std::max(cur.y + dy, 0), size.height - cur.height);
+
+      dx = nx - cur.x;
+      dy = ny - cur.y;
+      cur.x = nx;
+      cur.y = ny;
+
+      if (dx * dx + dy * dy < eps)
+	break;
+    }
+  window = cur;
+
+  // Size and orientation, computed as cv::CamShift does on the
+  // slightly enlarged window.
+  window.x = std::max(window.x - tolerance, 0);
+  window.y = std::max(window.y - tolerance, 0);
+  window.width = std::min(window.width + 2 * tolerance,
+			  size.width - window.x);
+  window.height = std::min(window.height + 2 * tolerance,
+			   size.height - window.y);
+
+  Moments m = moments(window);
+  if (std::fabs(m.m00) < DBL_EPSILON)
+    return cv::RotatedRect();
+
+  double inv_m00 = 1. / m.m00;
+  int xc = cvRound(m.m10 * inv_m00 + window.x);
+  int yc = cvRound(m.m01 * inv_m00 + window.y);
+  double a = m.mu20 * inv_m00;
+  double b = m.mu11 * inv_m00;
+  double c = m.mu02 * inv_m00;
+
+  double square = std::sqrt(4 * b * b + (a - c) * (a - c));
+  double theta = std::atan2(2 * b, a - c + square);
+
+  double cs = std::cos(theta);
+  double sn = std::sin(theta);
+  double rotate_a = cs * cs * m.mu20 + 2 * cs * sn * m.mu11
+    + sn * sn * m.mu02;
+  double rotate_c = sn * sn * m.mu20 - 2 * cs * sn * m.mu11
+    + cs * cs * m.mu02;
+  double length = std::sqrt(std::max(rotate_a * inv_m00, 0.)) * 4;
+  double width = std::sqrt(std::max(rotate_c * inv_m00, 0.)) * 4;
+
+  if (length < width)
+    {
+      std::swap(length, width);
+      std::swap(cs, sn);
+      theta = CV_PI * 0.5 - theta;
+    }
+
+  int t0 = cvRound(std::fabs(length * cs));
+  int t1 = cvRound(std::fabs(width * sn));
+  t0 = std::max(t0, t1) + 2;
+  window.width = std::min(t0, (size.width - xc) * 2);
+
+  t0 = cvRound(std::fabs(length * sn));
+  t1 = cvRound(std::fabs(width * cs));
+  t0 = std::max(t0, t1) + 2;
+  window.height = std::min(t0, (size.height - yc) * 2);
+
+  window.x = std::max(0, xc - window.width / 2);
+  window.y = std::max(0, yc - window.height / 2);
+  window.width = std::min(size.width - window.x, window.width);
+  window.height = std::min(size.height - window.y, window.height);
+
+  cv::RotatedRect box;
+  box.size.height = float(length);
+  box.size.width = float(width);
+  box.angle = float((CV_PI * 0.5 + theta) * 180. / CV_PI);
+  while (box.angle < 0)
+    box.angle += 360;
+  while (box.angle >= 360)
+    box.angle -= 360;
+  if (box.angle >= 180)
+    box.angle -= 180;
+  box.center = cv::Point2f(window.x + window.width * 0.5f,
+			   window.y + window.height * 0.5f);
+  return box;
+}
+
+std::size_t
+IntegralCamShift::allocations() const
+{
+  return workspace_.allocations();
+}
@@ -0,0 +1,101 @@
+#include "libhueblob/label_engine.hh"
+
+namespace
+{
+  static const int bits = Object::bgr_bits;
+  static const int shift = 8 - bits;
+  static const int cells = 1 << (3 * bits);
+} // end of anonymous namespace.
+
+LabelEngine::LabelEngine()
+  : table_(),
+    labels_(),
+    scores_(),
+    size_()
+{}
+
+void
+LabelEngine::compile(const std::vector<const Object*>& objects)
+{
+  CV_Assert(objects.size() <= max_objects);
+
+  table_ = cv::Mat::zeros(1, cells, CV_16U);
+  unsigned short* table = table_.ptr<unsigned short>();
+  for (std::size_t k = 0; k < objects.size(); ++k)
+    {
+      // Objects without view never win a cell, neither do the HSV
+      // ones: their BGR cube is not what they are tracked with.
+      if (!accepts(*objects[k]) || objects[k]->bgrLut_.empty())
+	continue;
+      const unsigned char* lut = objects[k]->bgrLut_.ptr<unsigned char>();
+      for (int cell = 0; cell < cells; ++cell)
+	if (lut[cell] > (table[cell] & 0xff))
+	  table[cell] = (k << 8) | lut[cell];
+    }
+  size_ = objects.size();
+}
+
+bool
+LabelEngine::accepts(const Object& object)
+{
+  return object.algo_ != NAIVE && object.lookup_ == BGR_LOOKUP;
+}
+
+std::size_t
+LabelEngine::size() const
+{
+  return size_;
+}
+
+void
+LabelEngine::label(const cv::Mat& image)
+{
+  CV_Assert(image.type() == CV_8UC3 && !table_.empty());
+
+  labels_.create(image.size(), CV_8UC1);
+  scores_.create(image.size(), CV_8UC1);
+  const unsigned short* table = table_.ptr<unsigned short>();
+  for (int i = 0; i < image.rows; ++i)
+    {
+      const unsigned char* src = image.ptr<unsigned char>(i);
+      unsigned char* label = labels_.ptr<unsigned char>(i);
+      unsigned char* score = scores_.ptr<unsigned char>(i);
+      for (int j = 0; j < image.cols; ++j, src += 3)
+	{
+	  unsigned short cell = table[((src[0] >> shift) << (2 * bits))
+				      | ((src[1] >> shift) << bits)
+				      | (src[2] >> shift)];
+	  label[j] = cell >> 8;
+	  score[j] = cell & 0xff;
+	}
+    }
+}
+
+void
+LabelEngine::likelihood(unsigned char label, const cv::Rect& region,
+			cv::Mat& dst) const
+{
+  dst.create(region.size(), CV_8UC1);
+  for (int i = 0; i < region.height; ++i)
+    {
+      const unsigned char* labels =
+	labels_.ptr<unsigned char>(region.y + i) + region.x;
+      const unsigned char* scores =
+	scores_.ptr<unsigned char>(region.y + i) + region.x;
+      unsigned char* out = dst.ptr<unsigned char>(i);
+      for (int j = 0; j < region.width; ++j)
+	out[j] = labels[j] == label ? scores[j] : 0;
+    }
+}
+
+const cv::Mat&
+LabelEngine::labels() const
+{
+  return labels_;
+}
+
+const cv::Mat&
+LabelEngine::scores() const
+{
+  return scores_;
+}
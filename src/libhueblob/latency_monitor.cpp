@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <time.h>
+#include <ros/console.h>
+#include "libhueblob/latency_monitor.hh"
+
+namespace
+{
+  /// \brief Percentile of sorted samples, nearest rank.
+  ///
+  /// The smallest sample such that at least percent of the samples
+  /// are lower or equal, i.e. rank ceil(percent * n / 100).
+  double percentile(const std::vector<double>& sorted, std::size_t percent)
+  {
+    const std::size_t rank = (percent * sorted.size() + 99) / 100;
+    return sorted[std::max<std::size_t>(rank, 1) - 1];
+  }
+} // end of anonymous namespace.
+
+LatencyStage::LatencyStage()
+  : name_(),
+    mutex_(),
+    values_(),
+    next_(),
+    window_(1)
+{}
+
+const std::string&
+LatencyStage::name() const
+{
+  return name_;
+}
+
+void
+LatencyStage::add(double seconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (values_.size() < window_)
+    values_.push_back(seconds);
+  else
+    values_[next_] = seconds;
+  next_ = (next_ + 1) % window_;
+}
+
+LatencyMonitor::LatencyMonitor(std::size_t window)
+  : window_(window ? window : 1),
+    mutex_(),
+    size_()
+{}
+
+double
+LatencyMonitor::now()
+{
+  timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + 1e-9 * time.tv_nsec;
+}
+
+LatencyStage*
+LatencyMonitor::stage(const std::string& name)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  for (std::size_t i = 0; i < size_; ++i)
+    if (stages_[i].name_ == name)
+      return &stages_[i];
+  if (size_ == max_stages)
+    {
+      ROS_WARN_STREAM("Too many latency stages, " << name << " is not timed");
+      return 0;
+    }
+
+  LatencyStage& stage = stages_[size_];
+  stage.name_ = name;
+  stage.window_ = window_;
+  stage.values_.reserve(window_);
+  ++size_;
+  return &stage;
+}
+
+void
+LatencyMonitor::toMessage(hueblob::LatencyStats& message) const
+{
+  std::size_t size;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    size = size_;
+  }
+
+  message.stages.clear();
+  std::vector<double> sorted;
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      const LatencyStage& stage = stages_[i];
+      {
+	boost::mutex::scoped_lock lock(stage.mutex_);
+	sorted = stage.values_;
+      }
+      if (sorted.empty())
+	continue;
+      std::sort(sorted.begin(), sorted.end());
+
+      hueblob::StageLatency latency;
+      latency.stage = stage.name_;
+      latency.count = sorted.size();
+      latency.p50 = percentile(sorted, 50);
+      latency.p95 = percentile(sorted, 95);
+      latency.p99 = percentile(sorted, 99);
+      latency.max = sorted.back();
+      message.stages.push_back(latency);
+    }
+}
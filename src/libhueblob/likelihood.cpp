@@ -0,0 +1,116 @@
+#include <cstring>
+#include "libhueblob/likelihood.hh"
+#include "libhueblob/object.hh"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HUEBLOB_AVX2_KERNEL
+# include <immintrin.h>
+#endif
+
+namespace
+{
+  static const int bits = Object::bgr_bits;
+  static const int shift = 8 - bits;
+
+  typedef void (*kernel_t)(const unsigned char* src, unsigned char* dst,
+			   int n, const unsigned char* table);
+
+  inline unsigned cubeIndex(const unsigned char* pixel)
+  {
+    return ((pixel[0] >> shift) << (2 * bits))
+      | ((pixel[1] >> shift) << bits)
+      | (pixel[2] >> shift);
+  }
+
+  void lookupScalar(const unsigned char* src, unsigned char* dst,
+		    int n, const unsigned char* table)
+  {
+    for (int j = 0; j < n; ++j, src += 3)
+      dst[j] = table[cubeIndex(src)];
+  }
+
+#ifdef HUEBLOB_AVX2_KERNEL
+  /// \brief Process eight pixels per iteration using gathers.
+  ///
+  /// Each lane loads the four bytes starting at its pixel (the three
+  /// channels plus the next pixel first byte), extracts the cube index
+  /// and gathers four table bytes from which only the first is kept.
+  /// This is why the table is padded with three bytes.
+  __attribute__((target("avx2")))
+  void lookupAVX2(const unsigned char* src, unsigned char* dst,
+		  int n, const unsigned char* table)
+  {
+    const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256i channel = _mm256_set1_epi32((1 << bits) - 1);
+    const __m256i low = _mm256_set1_epi32(0xff);
+    const __m256i pack =
+      _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+		       -1, -1, -1, -1, -1, -1, -1, -1,
+		       0, 4, 8, 12, -1, -1, -1, -1,
+		       -1, -1, -1, -1, -1, -1, -1, -1);
+
+    int j = 0;
+    // The last lane reads one byte past its pixel: stop while there
+    // is still a pixel after the current block.
+    for (; j + 9 <= n; j += 8, src += 24)
+      {
+	__m256i bgr =
+	  _mm256_i32gather_epi32(reinterpret_cast<const int*>(src),
+				 offsets, 1);
+	__m256i b = _mm256_and_si256(_mm256_srli_epi32(bgr, shift), channel);
+	__m256i g =
+	  _mm256_and_si256(_mm256_srli_epi32(bgr, 8 + shift), channel);
+	__m256i r =
+	  _mm256_and_si256(_mm256_srli_epi32(bgr, 16 + shift), channel);
+	__m256i index =
+	  _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(b, 2 * bits),
+					  _mm256_slli_epi32(g, bits)), r);
+
+	__m256i value =
+	  _mm256_i32gather_epi32(reinterpret_cast<const int*>(table),
+				 index, 1);
+	value = _mm256_shuffle_epi8(_mm256_and_si256(value, low), pack);
+
+	int lo = _mm_cvtsi128_si32(_mm256_castsi256_si128(value));
+	int hi = _mm_cvtsi128_si32(_mm256_extracti128_si256(value, 1));
+	std::memcpy(dst + j, &lo, sizeof(int));
+	std::memcpy(dst + j + 4, &hi, sizeof(int));
+      }
+    lookupScalar(src, dst + j, n - j, table);
+  }
+#endif
+
+  kernel_t selectKernel()
+  {
+#ifdef HUEBLOB_AVX2_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return lookupAVX2;
+#endif
+    return lookupScalar;
+  }
+} // end of anonymous namespace.
+
+void
+lookupLikelihood(const cv::Mat& image, const cv::Mat& lut, cv::Mat& dst)
+{
+  static const kernel_t kernel = selectKernel();
+
+  CV_Assert(image.type() == CV_8UC3);
+  CV_Assert(lut.isContinuous()
+	    && lut.total() >= (1u << (3 * bits)) + 3);
+
+  dst.create(image.size(), CV_8UC1);
+  const unsigned char* table = lut.ptr<unsigned char>();
+
+  int rows = image.rows;
+  int cols = image.cols;
+  if (image.isContinuous() && dst.isContinuous())
+    {
+      cols *= rows;
+      rows = 1;
+    }
+  for (int i = 0; i < rows; ++i)
+    kernel(image.ptr<unsigned char>(i), dst.ptr<unsigned char>(i),
+	   cols, table);
+}
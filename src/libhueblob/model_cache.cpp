@@ -0,0 +1,340 @@
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/cstdint.hpp>
+#include <ros/package.h>
+#include "libhueblob/model_cache.hh"
+
+namespace
+{
+  static const char magic[4] = {'H', 'B', 'M', 'C'};
+  static const boost::uint32_t version = 1;
+  static const int cells = 1 << (3 * Object::bgr_bits);
+  /// \brief Lookup tables size, including the padding.
+  static const int lut_size = cells + 3;
+
+  /// \brief Sequential writer, errors are checked once at the end.
+  class Writer
+  {
+  public:
+    explicit Writer(std::ofstream& out)
+      : out_(out)
+    {}
+
+    void raw(const void* data, std::size_t size)
+    {
+      out_.write(static_cast<const char*>(data), size);
+    }
+
+    void u32(boost::uint32_t value)
+    {
+      raw(&value, sizeof(value));
+    }
+
+    void string(const std::string& value)
+    {
+      u32(value.size());
+      raw(value.data(), value.size());
+    }
+
+    void scalar(const cv::Scalar& value)
+    {
+      raw(value.val, sizeof(value.val));
+    }
+
+    /// \brief Write a continuous matrix, its size must be implied.
+    void mat(const cv::Mat& value, std::size_t size)
+    {
+      CV_Assert(value.isContinuous()
+		&& value.total() * value.elemSize() == size);
+      raw(value.data, size);
+    }
+
+  private:
+    std::ofstream& out_;
+  };
+
+  /// \brief Bounds checked reader over a mapped file.
+  class Reader
+  {
+  public:
+    Reader(const char* data, std::size_t size)
+      : data_(data),
+	end_(data + size),
+	ok_(true)
+    {}
+
+    bool ok() const
+    {
+      return ok_;
+    }
+
+    void raw(void* data, std::size_t size)
+    {
+      if (!ok_ || std::size_t(end_ - data_) < size)
+	{
+	  ok_ = false;
+	  std::memset(data, 0, size);
+	  return;
+	}
+      std::memcpy(data, data_, size);
+      data_ += size;
+    }
+
+    boost::uint32_t u32()
+    {
+      boost::uint32_t value;
+      raw(&value, sizeof(value));
+      return value;
+    }
+
+    std::string string()
+    {
+      boost::uint32_t size = u32();
+      if (!ok_ || std::size_t(end_ - data_) < size)
+	{
+	  ok_ = false;
+	  return std::string();
+	}
+      std::string value(data_, size);
+      data_ += size;
+      return value;
+    }
+
+    cv::Scalar scalar()
+    {
+      cv::Scalar value;
+      raw(value.val, sizeof(value.val));
+      return value;
+    }
+
+    cv::Mat mat(int rows, int cols, int type)
+    {
+      cv::Mat value(rows, cols, type);
+      raw(value.data, value.total() * value.elemSize());
+      return value;
+    }
+
+  private:
+    const char* data_;
+    const char* end_;
+    bool ok_;
+  };
+
+  /// \brief Unmap the file when leaving the scope.
+  struct Mapping
+  {
+    Mapping(void* data, std::size_t size)
+      : data(data),
+	size(size)
+    {}
+
+    ~Mapping()
+    {
+      if (data != MAP_FAILED)
+	munmap(data, size);
+    }
+
+    void* data;
+    std::size_t size;
+  };
+
+  /// \brief Modification time, false if the file does not exist.
+  bool modificationTime(const std::string& filename, struct timespec& time)
+  {
+    struct stat status;
+    if (stat(filename.c_str(), &status))
+      return false;
+    time = status.st_mtim;
+    return true;
+  }
+
+  /// \brief Canonical path, or the path itself if it does not exist.
+  std::string canonicalPath(const std::string& path)
+  {
+    char resolved[PATH_MAX];
+    if (!realpath(path.c_str(), resolved))
+      return path;
+    return resolved;
+  }
+} // end of anonymous namespace.
+
+void
+saveModelCache(const std::string& filename,
+	       const std::vector<CachedModel>& models)
+{
+  std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("failed to open " + filename);
+
+  Writer writer(out);
+  writer.raw(magic, sizeof(magic));
+  writer.u32(version);
+  writer.u32(Object::h_bins);
+  writer.u32(Object::s_bins);
+  writer.u32(Object::hue_bins);
+  writer.u32(Object::bgr_bits);
+  writer.u32(models.size());
+
+  for (unsigned i = 0; i < models.size(); ++i)
+    {
+      const Object& object = models[i].object;
+      writer.string(models[i].name);
+      writer.string(models[i].path);
+      writer.raw(&object.anchor_x_, sizeof(double));
+      writer.raw(&object.anchor_y_, sizeof(double));
+      writer.raw(&object.anchor_z_, sizeof(double));
+
+      // Objects without views have no compiled tables.
+      const std::size_t views = object.modelHistogram_.size();
+      writer.u32(views);
+      if (!views)
+	continue;
+      for (unsigned view = 0; view < views; ++view)
+	{
+	  writer.mat(object.modelHistogram_[view],
+		     Object::h_bins * Object::s_bins * sizeof(float));
+	  writer.mat(object.hueHistogram_[view],
+		     Object::hue_bins * sizeof(float));
+	}
+      writer.mat(object.compiledHistogram_,
+		 Object::h_bins * Object::s_bins * sizeof(float));
+      writer.mat(object.bgrLut_, lut_size);
+      writer.mat(object.naiveLut_, lut_size);
+      writer.scalar(object.lower_hue_);
+      writer.scalar(object.upper_hue_);
+      writer.scalar(object.peak_color_);
+    }
+
+  out.close();
+  if (!out)
+    throw std::runtime_error("failed to write " + filename);
+}
+
+bool
+loadModelCache(const std::string& filename,
+	       std::vector<CachedModel>& models)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat status;
+  if (fstat(fd, &status) || !status.st_size)
+    {
+      close(fd);
+      return false;
+    }
+  // The mapping stays valid once the descriptor is closed.
+  Mapping mapping(mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0),
+		  status.st_size);
+  close(fd);
+  if (mapping.data == MAP_FAILED)
+    return false;
+
+  Reader reader(static_cast<const char*>(mapping.data), mapping.size);
+  char header[sizeof(magic)];
+  reader.raw(header, sizeof(header));
+  if (std::memcmp(header, magic, sizeof(magic))
+      || reader.u32() != version
+      || reader.u32() != boost::uint32_t(Object::h_bins)
+      || reader.u32() != boost::uint32_t(Object::s_bins)
+      || reader.u32() != boost::uint32_t(Object::hue_bins)
+      || reader.u32() != boost::uint32_t(Object::bgr_bits))
+    return false;
+
+  // Each model takes more than a byte: reject absurd counts before
+  // allocating anything.
+  const boost::uint32_t count = reader.u32();
+  if (!reader.ok() || count > mapping.size)
+    return false;
+  std::vector<CachedModel> result(count);
+  for (unsigned i = 0; reader.ok() && i < result.size(); ++i)
+    {
+      Object& object = result[i].object;
+      result[i].name = reader.string();
+      result[i].path = reader.string();
+      reader.raw(&object.anchor_x_, sizeof(double));
+      reader.raw(&object.anchor_y_, sizeof(double));
+      reader.raw(&object.anchor_z_, sizeof(double));
+
+      const boost::uint32_t views = reader.u32();
+      if (!views)
+	continue;
+      for (unsigned view = 0; reader.ok() && view < views; ++view)
+	{
+	  object.modelHistogram_.push_back
+	    (reader.mat(Object::h_bins, Object::s_bins, CV_32F));
+	  object.hueHistogram_.push_back
+	    (reader.mat(Object::hue_bins, 1, CV_32F));
+	}
+      object.compiledHistogram_ =
+	reader.mat(Object::h_bins, Object::s_bins, CV_32F);
+      object.bgrLut_ = reader.mat(1, lut_size, CV_8U);
+      object.naiveLut_ = reader.mat(1, lut_size, CV_8U);
+      object.lower_hue_ = reader.scalar();
+      object.upper_hue_ = reader.scalar();
+      object.peak_color_ = reader.scalar();
+    }
+  if (!reader.ok())
+    return false;
+
+  models.swap(result);
+  return true;
+}
+
+bool
+modelCacheFresh(const std::string& filename,
+		const std::vector<std::string>& sources)
+{
+  struct timespec cache;
+  if (!modificationTime(filename, cache))
+    return false;
+  for (unsigned i = 0; i < sources.size(); ++i)
+    {
+      struct timespec source;
+      if (!modificationTime(sources[i], source))
+	return false;
+      if (source.tv_sec > cache.tv_sec
+	  || (source.tv_sec == cache.tv_sec && source.tv_nsec > cache.tv_nsec))
+	return false;
+    }
+  return true;
+}
+
+const CachedModel*
+findCachedModel(const std::vector<CachedModel>& models,
+		const std::string& name, const std::string& path)
+{
+  const std::string canonical = canonicalPath(path);
+  for (unsigned i = 0; i < models.size(); ++i)
+    if (models[i].name == name
+	&& (models[i].path == path
+	    || canonicalPath(models[i].path) == canonical))
+      return &models[i];
+  return 0;
+}
+
+std::string
+resolveModelPath(const std::string& url)
+{
+  static const std::string file = "file://";
+  static const std::string package = "package://";
+  if (url.compare(0, file.size(), file) == 0)
+    return url.substr(file.size());
+  if (url.compare(0, package.size(), package) != 0)
+    return url;
+
+  const std::string::size_type slash = url.find('/', package.size());
+  const std::string root =
+    ros::package::getPath(url.substr(package.size(),
+				      slash - package.size()));
+  if (root.empty())
+    return std::string();
+  return slash == std::string::npos ? root : root + url.substr(slash);
+}
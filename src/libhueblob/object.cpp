@@ -1,7 +1,11 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/video/tracking.hpp>
 #include "libhueblob/object.hh"
+#include "libhueblob/label_engine.hh"
+#include "libhueblob/latency_monitor.hh"
+#include "libhueblob/likelihood.hh"
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include "highgui.h"
 // Histogram parameters initialization.
@@ -12,6 +16,50 @@ static const float hue_range[] = { 0, 250 };
 static const float sat_range[] = { 0, 250 };
 //  combine the two previous information
 static const float* ranges[] = { hue_range, sat_range };
+// Back projection values below this threshold are discarded.
+static const double likelihood_threshold = 32;
+// Naive algorithm: hue histogram of the pixels which are saturated
+// and bright enough,
+static const float full_hue_range[] = { 0, 180 };
+static const int naive_min_saturation = 64;
+static const int naive_min_value = 32;
+// the hue range spans the bins around the peak holding at least this
+// fraction of it,
+static const double naive_hue_fraction = 0.05;
+// plus a margin, in bins.
+static const int naive_hue_margin = 4;
+// Smaller connected components are ignored, in pixels.
+static const double naive_min_area = 16;
+
+namespace
+{
+  /// \brief Workspace slots, pyramid levels come last.
+  enum
+  {
+    MASK_GRAY_BUFFER,
+    MASK_BUFFER,
+    VIEW_HSV_BUFFER,
+    VIEW_SATURATED_BUFFER,
+    HSV_BUFFER,
+    BACK_PROJECT_BUFFER,
+    LIKELIHOOD_BUFFER,
+    NAIVE_MASK_BUFFER,
+    PYRAMID_BUFFER
+  };
+
+  /// \brief Timed substeps, see setLatency.
+  enum
+  {
+    CVT_COLOR_LATENCY,
+    BACK_PROJECTION_LATENCY,
+    THRESHOLD_LATENCY,
+    MEDIAN_LATENCY,
+    CAMSHIFT_LATENCY,
+    LATENCY_STAGES
+  };
+  static const char* const latency_names[LATENCY_STAGES] =
+    {"cvt_color", "back_projection", "threshold", "median", "camshift"};
+} // end of anonymous namespace.
 
 
 Object::Object()
@@ -20,14 +68,36 @@ Object::Object()
      anchor_y_(),
      anchor_z_(),
      modelHistogram_(),
-     searchWindow_(-1, -1, -1, -1)
+     compiledHistogram_(),
+     bgrLut_(),
+     lookup_(HSV_LOOKUP),
+     algo_(CAMSHIFT),
+     hueHistogram_(),
+     lower_hue_(),
+     upper_hue_(),
+     peak_color_(),
+     naiveLut_(),
+     contours_(),
+     searchWindow_(-1, -1, -1, -1),
+     roiGating_(false),
+     roiMargin_(32),
+     reacquirePeriod_(30),
+     framesSinceReacquire_(0),
+     pyramidLevels_(0),
+     integralCamShift_(false),
+     integralSecondOrder_(false),
+     camShift_(),
+     workspace_(),
+     backProject_(),
+     likelihood_(),
+     latency_()
 {}
 
 cv::Mat
 Object::computeMask(const cv::Mat& model)
 {
-  cv::Mat gmodel(model.size(), CV_8UC1);
-  cv::Mat mask(model.size(), CV_8UC1);
+  cv::Mat gmodel = workspace_.buffer(MASK_GRAY_BUFFER, model.size(), CV_8UC1);
+  cv::Mat mask = workspace_.buffer(MASK_BUFFER, model.size(), CV_8UC1);
 
   cv::cvtColor(model, gmodel, CV_BGR2GRAY);
 
@@ -46,7 +116,7 @@ Object::addView(const cv::Mat& model)
   // Compute the histogram.
   //  only use channels 0 and 1 (hue and saturation).
   int channels[] = {0, 1};
-  cv::Mat hsv;
+  cv::Mat hsv = workspace_.buffer(VIEW_HSV_BUFFER, model.size(), CV_8UC3);
   cv::MatND hist;
   cv::cvtColor(model, hsv, CV_BGR2HSV);
   // cv::imshow("test", hsv );
@@ -67,9 +137,123 @@ Object::addView(const cv::Mat& model)
   cv::convertScaleAbs(hist_, hist_, max ? 255. / max : 0., 0);
   this->modelHistogram_.push_back(hist);
 
+  // Hue histogram of the saturated pixels, for the naive algorithm.
+  cv::Mat saturated =
+    workspace_.buffer(VIEW_SATURATED_BUFFER, model.size(), CV_8UC1);
+  cv::inRange(hsv, cv::Scalar(0, naive_min_saturation, naive_min_value),
+	      cv::Scalar(255, 255, 255), saturated);
+  cv::bitwise_and(saturated, mask, saturated);
+  int hue_channel[] = {0};
+  int hue_size[] = {hue_bins};
+  const float* hue_ranges[] = { full_hue_range };
+  cv::MatND hue;
+  calcHist(&hsv, 1, hue_channel, saturated,
+	   hue, 1, hue_size, hue_ranges,
+	   true, false);
+  this->hueHistogram_.push_back(hue);
+  compileModel();
+
   // compute histogram and thresholds for naive method
 }
 
+void
+Object::compileModel()
+{
+  if (modelHistogram_.empty())
+    {
+      compiledHistogram_ = cv::MatND();
+      bgrLut_ = cv::Mat();
+      naiveLut_ = cv::Mat();
+      return;
+    }
+
+  // Back projection saturates each bin to an unsigned char, then
+  // views are merged with a saturated addition: doing the same thing
+  // on the bins directly gives an equivalent table.
+  cv::Mat compiled = cv::Mat::zeros(h_bins, s_bins, CV_8U);
+  cv::Mat view;
+  for (unsigned i = 0; i < modelHistogram_.size(); ++i)
+    {
+      modelHistogram_[i].convertTo(view, CV_8U);
+      cv::add(compiled, view, compiled);
+    }
+  compiled.convertTo(compiledHistogram_, CV_32F);
+
+  // Evaluate the table at the center of every cell of the BGR cube:
+  // rows enumerate (b, g), columns enumerate r.
+  static const int levels = 1 << bgr_bits;
+  static const int step = 256 / levels;
+  cv::Mat cube(levels * levels, levels, CV_8UC3);
+  for (int b = 0; b < levels; ++b)
+    for (int g = 0; g < levels; ++g)
+      for (int r = 0; r < levels; ++r)
+	cube.at<cv::Vec3b>(b * levels + g, r) =
+	  cv::Vec3b(b * step + step / 2, g * step + step / 2,
+		    r * step + step / 2);
+
+  cv::Mat cubeHSV;
+  cv::cvtColor(cube, cubeHSV, CV_BGR2HSV);
+  int channels[] = {0, 1};
+  cv::Mat lut;
+  cv::calcBackProject(&cubeHSV, 1, channels, compiledHistogram_, lut, ranges);
+
+  // Fold the threshold in and pad the table for the vectorized lookup
+  // (see lookupLikelihood).
+  cv::threshold(lut, lut, likelihood_threshold, 0, CV_THRESH_TOZERO);
+  static const int cells = levels * levels * levels;
+  bgrLut_ = cv::Mat::zeros(1, cells + 3, CV_8U);
+  lut.reshape(1, 1).copyTo(bgrLut_.colRange(0, cells));
+
+  // Naive algorithm: grow the hue range around the histogram peak,
+  // wrapping around red.
+  cv::Mat hue = cv::Mat::zeros(hue_bins, 1, CV_32F);
+  for (unsigned i = 0; i < hueHistogram_.size(); ++i)
+    cv::add(hue, hueHistogram_[i], hue);
+  double peakValue = 0.;
+  cv::Point peak;
+  cv::minMaxLoc(hue, 0, &peakValue, 0, &peak);
+  const float* bins = hue.ptr<float>();
+  const double minBin = peakValue * naive_hue_fraction;
+  int lower = peak.y;
+  int upper = peak.y;
+  while (upper - lower < hue_bins - 1
+	 && bins[(lower - 1 + hue_bins) % hue_bins] > minBin)
+    --lower;
+  while (upper - lower < hue_bins - 1
+	 && bins[(upper + 1) % hue_bins] > minBin)
+    ++upper;
+  lower -= naive_hue_margin;
+  upper += naive_hue_margin;
+  if (upper - lower >= hue_bins - 1)
+    {
+      lower = 0;
+      upper = hue_bins - 1;
+    }
+  lower = (lower + hue_bins) % hue_bins;
+  upper = upper % hue_bins;
+  lower_hue_ = cv::Scalar(lower, naive_min_saturation, naive_min_value);
+  upper_hue_ = cv::Scalar(upper, 255, 255);
+  peak_color_ = cv::Scalar(peak.y, 255, 255);
+
+  // Evaluate the bounds on the BGR cube, views without any saturated
+  // pixel give an empty range.
+  naiveLut_ = cv::Mat::zeros(1, cells + 3, CV_8U);
+  if (peakValue <= 0.)
+    return;
+  unsigned char* naive = naiveLut_.ptr<unsigned char>();
+  const cv::Vec3b* cell = cubeHSV.ptr<cv::Vec3b>();
+  for (int i = 0; i < cells; ++i)
+    {
+      int h = cell[i][0];
+      bool in = lower <= upper
+	? lower <= h && h <= upper
+	: lower <= h || h <= upper;
+      if (in && cell[i][1] >= naive_min_saturation
+	  && cell[i][2] >= naive_min_value)
+	naive[i] = 255;
+    }
+}
+
 
 namespace
 {
@@ -92,57 +276,247 @@ namespace
     if (rect.y + rect.height > backProject.rows - 1)
       rect.height = backProject.rows - 1 - rect.y;
   }
+
+  /// \brief Expand the search window by a margin, clipped to an area.
+  cv::Rect gateRegion(const cv::Rect& window, const cv::Rect& area,
+		      int minMargin)
+  {
+    int margin = std::max(minMargin,
+			  std::max(window.width, window.height) / 2);
+    cv::Rect region(window.x - margin, window.y - margin,
+		    window.width + 2 * margin, window.height + 2 * margin);
+    return region & area;
+  }
 } // end of anonymous namespace.
 
+void
+Object::computeLikelihood(const cv::Mat& image, const cv::Mat& hsv)
+{
+  // Functions below only reallocate their output when its size or
+  // type is wrong: writing into workspace views never allocates.
+  backProject_ = workspace_.buffer(BACK_PROJECT_BUFFER, image.size(), CV_8UC1);
+  likelihood_ = workspace_.buffer(LIKELIHOOD_BUFFER, image.size(), CV_8UC1);
+
+  if (lookup_ == BGR_LOOKUP)
+    {
+      // Conversion, back projection and threshold in a single pass.
+      LatencyMonitor::Scope timing(latencyStage(BACK_PROJECTION_LATENCY));
+      lookupLikelihood(image, bgrLut_, backProject_);
+    }
+  else
+    {
+      // Convert to HSV, unless the caller already did it.
+      cv::Mat imgHSV = hsv;
+      if (imgHSV.empty())
+	{
+	  LatencyMonitor::Scope timing(latencyStage(CVT_COLOR_LATENCY));
+	  imgHSV = workspace_.buffer(HSV_BUFFER, image.size(), CV_8UC3);
+	  cv::cvtColor(image, imgHSV, CV_BGR2HSV);
+	}
+
+      // Compute back projection.
+      //  only use channels 0 and 1 (hue and saturation).
+      {
+	LatencyMonitor::Scope timing(latencyStage(BACK_PROJECTION_LATENCY));
+	int channels[] = {0, 1};
+	cv::calcBackProject(&imgHSV, 1, channels, compiledHistogram_,
+			    backProject_,
+			    ranges);
+      }
+      LatencyMonitor::Scope timing(latencyStage(THRESHOLD_LATENCY));
+      cv::threshold(backProject_, backProject_, likelihood_threshold, 0,
+		    CV_THRESH_TOZERO);
+    }
+  LatencyMonitor::Scope timing(latencyStage(MEDIAN_LATENCY));
+  cv::medianBlur(backProject_, likelihood_, 3);
+}
+
 boost::optional<cv::RotatedRect>
 Object::track(const cv::Mat& image)
 {
-  boost::optional<cv::RotatedRect> result;
+  return track(image, cv::Mat());
+}
 
-  int nViews = modelHistogram_.size();
-  if (!nViews)
-    return result;
+boost::optional<cv::RotatedRect>
+Object::track(const cv::Mat& image, const cv::Mat& hsv)
+{
+  return track(image, hsv, cv::Rect(0, 0, image.cols, image.rows));
+}
 
-  // Convert to HSV.
-  cv::cvtColor(image, imgHSV_, CV_BGR2HSV);
+boost::optional<cv::RotatedRect>
+Object::track(const cv::Mat& image, const cv::Mat& hsv, const cv::Rect& area)
+{
+  if (compiledHistogram_.empty())
+    return boost::optional<cv::RotatedRect>();
+  cv::Rect frame = area & cv::Rect(0, 0, image.cols, image.rows);
+  if (frame.width <= 0 || frame.height <= 0)
+    return boost::optional<cv::RotatedRect>();
+  if (algo_ == NAIVE)
+    return trackNaive(image, frame);
+  if (pyramidLevels_ > 0)
+    return trackPyramid(image, hsv, frame);
 
-  // Compute back projection.
-  //  only use channels 0 and 1 (hue and saturation).
-  int channels[] = {0, 1};
-  cv::Mat backProject;
-  cv::calcBackProject(&imgHSV_, 1, channels, modelHistogram_[0],
-                      backProject,
-		      ranges);
+  cv::Rect region = trackingRegion(frame);
+  computeLikelihood(image(region), hsv.empty() ? hsv : hsv(region));
+  return trackLikelihood(likelihood_, region);
+}
 
-  for(int nmodel = 1; nmodel < nViews; ++nmodel)
+boost::optional<cv::RotatedRect>
+Object::trackNaive(const cv::Mat& image, const cv::Rect& area)
+{
+  // In range mask, computed on BGR pixels by the likelihood kernel.
+  cv::Rect region = trackingRegion(area);
+  cv::Mat mask = workspace_.buffer(NAIVE_MASK_BUFFER, region.size(), CV_8UC1);
+  lookupLikelihood(image(region), naiveLut_, mask);
+
+  // Keep the largest connected component, the mask is overwritten.
+  cv::findContours(mask, contours_, CV_RETR_EXTERNAL,
+		   CV_CHAIN_APPROX_SIMPLE, region.tl());
+  int best = -1;
+  double bestArea = naive_min_area;
+  for (unsigned i = 0; i < contours_.size(); ++i)
+    {
+      double contourArea = cv::contourArea(contours_[i]);
+      if (contourArea >= bestArea)
+	{
+	  best = i;
+	  bestArea = contourArea;
+	}
+    }
+  if (best < 0)
+    {
+      searchWindow_.x = searchWindow_.y = -1;
+      return boost::optional<cv::RotatedRect>();
+    }
+
+  const std::vector<cv::Point>& blob = contours_[best];
+  searchWindow_ = cv::boundingRect(blob);
+  if (blob.size() < 5)
+    return cv::minAreaRect(blob);
+  return cv::fitEllipse(blob);
+}
+
+boost::optional<cv::RotatedRect>
+Object::trackPyramid(const cv::Mat& image, const cv::Mat& hsv,
+		     const cv::Rect& area)
+{
+  // Coarse step: search in the downscaled tracked region.
+  cv::Rect region = trackingRegion(area);
+  cv::Mat coarse = image(region);
+  for (int level = 0; level < pyramidLevels_; ++level)
     {
-      cv::Mat backProjectTmp;
-      cv::calcBackProject(&imgHSV_, 1, channels, modelHistogram_[nmodel],
-			  backProjectTmp, ranges);
-
-      // Merge back projections while taking care of overflows.
-      for (int i = 0 ; i < backProject.rows; ++i)
-	for (int j = 0 ; j < backProject.cols; ++j)
-	  {
-	    int v =
-	      backProject.at<unsigned char>(i, j)
-	      + backProjectTmp.at<unsigned char>(i, j);
-	    if (v <= 0)
-	      v = 0;
-	    else if (v >= 255)
-	      v = 255;
-	    backProject.at<unsigned char>(i, j) = v;
-	  }
+      cv::Size size((coarse.cols + 1) / 2, (coarse.rows + 1) / 2);
+      cv::Mat down = workspace_.buffer(PYRAMID_BUFFER + level, size,
+				       image.type());
+      if (down.empty())
+	return boost::optional<cv::RotatedRect>();
+      cv::pyrDown(coarse, down, size);
+      coarse = down;
     }
+  if (coarse.empty())
+    return boost::optional<cv::RotatedRect>();
+
+  computeLikelihood(coarse, cv::Mat());
+  // pyrDown rounds each axis up on its own, the scales differ slightly.
+  const double scaleX = double(region.width) / coarse.cols;
+  const double scaleY = double(region.height) / coarse.rows;
+  if (!trackLikelihood(likelihood_, region, scaleX, scaleY))
+    return boost::optional<cv::RotatedRect>();
+
+  // Fine step: CamShift needs the whole window, so the likelihood is
+  // recomputed at full resolution over the coarse window plus a
+  // margin of a few coarse pixels.
+  int margin = 2 << pyramidLevels_;
+  cv::Rect fine(searchWindow_.x - margin, searchWindow_.y - margin,
+		searchWindow_.width + 2 * margin,
+		searchWindow_.height + 2 * margin);
+  fine &= area;
+  if (fine.width <= 0 || fine.height <= 0)
+    return boost::optional<cv::RotatedRect>();
+
+  computeLikelihood(image(fine), hsv.empty() ? hsv : hsv(fine));
+  return trackLikelihood(likelihood_, fine);
+}
+
+boost::optional<cv::RotatedRect>
+Object::track(const LabelEngine& engine, unsigned char label)
+{
+  const cv::Mat& labels = engine.labels();
+  return track(engine, label, cv::Rect(0, 0, labels.cols, labels.rows));
+}
+
+boost::optional<cv::RotatedRect>
+Object::track(const LabelEngine& engine, unsigned char label,
+	      const cv::Rect& area)
+{
+  if (compiledHistogram_.empty() || engine.labels().empty())
+    return boost::optional<cv::RotatedRect>();
+  const cv::Mat& labels = engine.labels();
+  cv::Rect frame = area & cv::Rect(0, 0, labels.cols, labels.rows);
+  if (frame.width <= 0 || frame.height <= 0)
+    return boost::optional<cv::RotatedRect>();
+
+  cv::Rect region = trackingRegion(frame);
+  backProject_ = workspace_.buffer(BACK_PROJECT_BUFFER, region.size(), CV_8UC1);
+  likelihood_ = workspace_.buffer(LIKELIHOOD_BUFFER, region.size(), CV_8UC1);
+  {
+    LatencyMonitor::Scope timing(latencyStage(BACK_PROJECTION_LATENCY));
+    engine.likelihood(label, region, backProject_);
+  }
+  {
+    LatencyMonitor::Scope timing(latencyStage(MEDIAN_LATENCY));
+    cv::medianBlur(backProject_, likelihood_, 3);
+  }
+  return trackLikelihood(likelihood_, region);
+}
+
+cv::Rect
+Object::trackingRegion(const cv::Rect& area)
+{
+  // Restrict per-pixel work around the last known position while
+  // the track is healthy, process the whole area otherwise.
+  cv::Rect region = area;
+  if (roiGating_ && searchWindow_.x >= 0 && searchWindow_.y >= 0
+      && ++framesSinceReacquire_ < reacquirePeriod_)
+    region = gateRegion(searchWindow_, area, roiMargin_);
+  else
+    framesSinceReacquire_ = 0;
+  if (region.width <= 0 || region.height <= 0)
+    region = area;
+  return region;
+}
+
+bool
+Object::readsAreaHsv() const
+{
+  return algo_ == CAMSHIFT && lookup_ == HSV_LOOKUP
+    && !roiGating_ && pyramidLevels_ == 0;
+}
 
-  cv::threshold(backProject, backProject, 32, 0, CV_THRESH_TOZERO);
-  cv::medianBlur(backProject, backProject, 3);
+boost::optional<cv::RotatedRect>
+Object::trackLikelihood(const cv::Mat& likelihood, const cv::Rect& region,
+			double scaleX, double scaleY)
+{
+  boost::optional<cv::RotatedRect> result;
 
-  resetSearchZone(searchWindow_, backProject);
+  cv::Rect window(cvFloor((searchWindow_.x - region.x) / scaleX),
+		  cvFloor((searchWindow_.y - region.y) / scaleY),
+		  cvCeil(searchWindow_.width / scaleX),
+		  cvCeil(searchWindow_.height / scaleY));
+  if (searchWindow_.x < 0 || searchWindow_.y < 0)
+    window.x = window.y = -1;
+  resetSearchZone(window, likelihood);
 
   cv::TermCriteria criteria =
     cv::TermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 50, 1);
-  result = cv::CamShift(backProject, searchWindow_, criteria);
+  LatencyMonitor::Scope timing(latencyStage(CAMSHIFT_LATENCY));
+  if (integralCamShift_)
+    {
+      camShift_.setImage(likelihood, integralSecondOrder_);
+      result = camShift_(window, criteria);
+    }
+  else
+    result = cv::CamShift(likelihood, window, criteria);
 
   if (std::abs(result->size.width) > 1e6)
     {
@@ -150,6 +524,17 @@ Object::track(const cv::Mat& image)
       return boost::optional<cv::RotatedRect>();
     }
 
+  // Scale each side along its own direction, the angle is kept: the
+  // two scales are close enough for the ellipse to stay one.
+  const double angle = result->angle * CV_PI / 180.;
+  const double c = std::cos(angle);
+  const double s = std::sin(angle);
+  result->center = cv::Point2f(region.x + result->center.x * scaleX,
+			       region.y + result->center.y * scaleY);
+  result->size.width *= std::sqrt(scaleX * c * scaleX * c
+				  + scaleY * s * scaleY * s);
+  result->size.height *= std::sqrt(scaleX * s * scaleX * s
+				   + scaleY * c * scaleY * c);
   searchWindow_ = result->boundingRect();
 
   if (searchWindow_.height <= 0 || searchWindow_.width <= 0)
@@ -157,10 +542,50 @@ Object::track(const cv::Mat& image)
   return result;
 }
 
+void
+Object::setLatency(LatencyMonitor* latency)
+{
+  latency_.clear();
+  if (!latency)
+    return;
+  for (int stage = 0; stage < LATENCY_STAGES; ++stage)
+    latency_.push_back(latency->stage(latency_names[stage]));
+}
+
+LatencyStage*
+Object::latencyStage(std::size_t stage) const
+{
+  return latency_.empty() ? 0 : latency_[stage];
+}
+
+std::size_t
+Object::workspaceAllocations() const
+{
+  return workspace_.allocations() + camShift_.allocations();
+}
+
 void
 Object::clearViews()
 {
   modelHistogram_.clear();
+  hueHistogram_.clear();
+  compileModel();
+}
+
+void
+Object::copyModel(const Object& model)
+{
+  anchor_x_ = model.anchor_x_;
+  anchor_y_ = model.anchor_y_;
+  anchor_z_ = model.anchor_z_;
+  modelHistogram_ = model.modelHistogram_;
+  compiledHistogram_ = model.compiledHistogram_;
+  bgrLut_ = model.bgrLut_;
+  hueHistogram_ = model.hueHistogram_;
+  lower_hue_ = model.lower_hue_;
+  upper_hue_ = model.upper_hue_;
+  peak_color_ = model.peak_color_;
+  naiveLut_ = model.naiveLut_;
 }
 
 void
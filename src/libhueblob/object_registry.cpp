@@ -0,0 +1,58 @@
+#include "libhueblob/object_registry.hh"
+
+ObjectRegistry::ObjectRegistry()
+  : current_(new models_t()),
+    current_mutex_(),
+    write_mutex_()
+{}
+
+ObjectRegistry::snapshot_t
+ObjectRegistry::snapshot() const
+{
+  boost::mutex::scoped_lock lock(current_mutex_);
+  return current_;
+}
+
+void
+ObjectRegistry::insert(const std::string& name, const model_t& model)
+{
+  boost::mutex::scoped_lock lock(write_mutex_);
+  boost::shared_ptr<models_t> next(new models_t(*snapshot()));
+  (*next)[name] = model;
+  publish(next);
+}
+
+void
+ObjectRegistry::insert(const models_t& models)
+{
+  boost::mutex::scoped_lock lock(write_mutex_);
+  boost::shared_ptr<models_t> next(new models_t(*snapshot()));
+  for (models_t::const_iterator it = models.begin(); it != models.end(); ++it)
+    (*next)[it->first] = it->second;
+  publish(next);
+}
+
+bool
+ObjectRegistry::erase(const std::string& name)
+{
+  boost::mutex::scoped_lock lock(write_mutex_);
+  snapshot_t current = snapshot();
+  if (!current->count(name))
+    return false;
+  boost::shared_ptr<models_t> next(new models_t(*current));
+  next->erase(name);
+  publish(next);
+  return true;
+}
+
+void
+ObjectRegistry::publish(const snapshot_t& snapshot)
+{
+  // The previous version is released outside of the lock, destroying
+  // it if no reader still uses it.
+  snapshot_t previous = snapshot;
+  {
+    boost::mutex::scoped_lock lock(current_mutex_);
+    current_.swap(previous);
+  }
+}
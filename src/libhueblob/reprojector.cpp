@@ -0,0 +1,147 @@
+#include "libhueblob/reprojector.hh"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+# define HUEBLOB_SSE2_KERNEL
+# include <emmintrin.h>
+#endif
+
+Reprojector::Reprojector()
+  : fx_(),
+    fy_(),
+    cx_(),
+    cy_(),
+    columnRays_(),
+    rowRays_(),
+    focalBaseline_(),
+    minDisparity_(),
+    maxDisparity_(),
+    x_(),
+    y_(),
+    z_(),
+    columns_()
+{}
+
+bool
+Reprojector::setCamera(double fx, double fy, double cx, double cy,
+		       int width, int height)
+{
+  if (fx == fx_ && fy == fy_ && cx == cx_ && cy == cy_
+      && columnRays_.size() == std::size_t(width)
+      && rowRays_.size() == std::size_t(height))
+    return false;
+
+  fx_ = fx;
+  fy_ = fy;
+  cx_ = cx;
+  cy_ = cy;
+  columnRays_.resize(width);
+  for (int u = 0; u < width; ++u)
+    columnRays_[u] = (u - cx) / fx;
+  rowRays_.resize(height);
+  for (int v = 0; v < height; ++v)
+    rowRays_[v] = (v - cy) / fy;
+
+  x_.resize(width);
+  y_.resize(width);
+  z_.resize(width);
+  columns_.resize(width);
+  return true;
+}
+
+void
+Reprojector::setDisparity(float focalBaseline,
+			  float minDisparity, float maxDisparity)
+{
+  focalBaseline_ = focalBaseline;
+  minDisparity_ = minDisparity;
+  maxDisparity_ = maxDisparity;
+}
+
+cv::Point3f
+Reprojector::point(float u, float v, float disparity) const
+{
+  const float z = focalBaseline_ / disparity;
+  return cv::Point3f((u - cx_) / fx_ * z, (v - cy_) / fy_ * z, z);
+}
+
+int
+Reprojector::projectRow(const float* disparity, int row, int begin, int end)
+{
+  const float rowRay = rowRays_[row];
+  const float* columnRays = &columnRays_[0];
+  int count = 0;
+  int u = begin;
+
+#ifdef HUEBLOB_SSE2_KERNEL
+  // Comparisons involving NaN are false, so NaN pixels fail the range
+  // test without a dedicated check.
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 low = _mm_set1_ps(minDisparity_);
+  const __m128 high = _mm_set1_ps(maxDisparity_);
+  const __m128 scale = _mm_set1_ps(focalBaseline_);
+  const __m128 rowRays = _mm_set1_ps(rowRay);
+  for (; u + 4 <= end; u += 4)
+    {
+      const __m128 d = _mm_loadu_ps(disparity + u);
+      const __m128 valid =
+	_mm_and_ps(_mm_and_ps(_mm_cmpge_ps(d, low), _mm_cmple_ps(d, high)),
+		   _mm_cmpneq_ps(d, zero));
+      const int mask = _mm_movemask_ps(valid);
+      if (!mask)
+	continue;
+
+      const __m128 z = _mm_div_ps(scale, d);
+      float x[4], y[4], zs[4];
+      _mm_storeu_ps(x, _mm_mul_ps(_mm_loadu_ps(columnRays + u), z));
+      _mm_storeu_ps(y, _mm_mul_ps(rowRays, z));
+      _mm_storeu_ps(zs, z);
+      for (int lane = 0; lane < 4; ++lane)
+	if (mask & (1 << lane))
+	  {
+	    x_[count] = x[lane];
+	    y_[count] = y[lane];
+	    z_[count] = zs[lane];
+	    columns_[count] = u + lane;
+	    ++count;
+	  }
+    }
+#endif
+
+  for (; u < end; ++u)
+    {
+      const float d = disparity[u];
+      if (!(d >= minDisparity_ && d <= maxDisparity_) || d == 0.f)
+	continue;
+      const float z = focalBaseline_ / d;
+      x_[count] = columnRays[u] * z;
+      y_[count] = rowRay * z;
+      z_[count] = z;
+      columns_[count] = u;
+      ++count;
+    }
+  return count;
+}
+
+const float*
+Reprojector::rowX() const
+{
+  return &x_[0];
+}
+
+const float*
+Reprojector::rowY() const
+{
+  return &y_[0];
+}
+
+const float*
+Reprojector::rowZ() const
+{
+  return &z_[0];
+}
+
+const int*
+Reprojector::rowColumns() const
+{
+  return &columns_[0];
+}
@@ -0,0 +1,100 @@
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include "libhueblob/worker_pool.hh"
+
+WorkerPool::WorkerPool(unsigned threads)
+  : size_(threads ? threads : 1),
+    threads_(),
+    run_mutex_(),
+    mutex_(),
+    work_(),
+    done_(),
+    batch_(),
+    next_(),
+    pending_(),
+    error_(),
+    stop_(false)
+{
+  for (unsigned i = 1; i < size_; ++i)
+    threads_.create_thread(boost::bind(&WorkerPool::work, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_.notify_all();
+  threads_.join_all();
+}
+
+unsigned
+WorkerPool::size() const
+{
+  return size_;
+}
+
+void
+WorkerPool::run(const std::vector<task_t>& tasks)
+{
+  if (tasks.empty())
+    return;
+
+  boost::unique_lock<boost::mutex> run_lock(run_mutex_);
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  batch_ = &tasks;
+  next_ = 0;
+  pending_ = tasks.size();
+  error_.clear();
+  work_.notify_all();
+
+  drain(lock);
+  while (pending_)
+    done_.wait(lock);
+  batch_ = 0;
+
+  if (!error_.empty())
+    throw std::runtime_error(error_);
+}
+
+void
+WorkerPool::work()
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (!stop_)
+    {
+      drain(lock);
+      work_.wait(lock);
+    }
+}
+
+void
+WorkerPool::drain(boost::unique_lock<boost::mutex>& lock)
+{
+  while (batch_ && next_ < batch_->size())
+    {
+      const task_t& task = (*batch_)[next_++];
+      std::string error;
+
+      lock.unlock();
+      try
+	{
+	  task();
+	}
+      catch (const std::exception& e)
+	{
+	  error = e.what();
+	}
+      catch (...)
+	{
+	  error = "unknown exception";
+	}
+      lock.lock();
+
+      if (!error.empty() && error_.empty())
+	error_ = error;
+      if (!--pending_)
+	done_.notify_all();
+    }
+}
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include "libhueblob/workspace.hh"
+
+Workspace::Workspace()
+  : buffers_(),
+    allocations_()
+{}
+
+Workspace::Workspace(const Workspace&)
+  : buffers_(),
+    allocations_()
+{}
+
+Workspace&
+Workspace::operator=(const Workspace&)
+{
+  buffers_.clear();
+  allocations_ = 0;
+  return *this;
+}
+
+cv::Mat
+Workspace::buffer(std::size_t slot, const cv::Size& size, int type)
+{
+  if (size.width <= 0 || size.height <= 0)
+    return cv::Mat();
+  reserve(slot, size, type);
+  return buffers_[slot](cv::Rect(0, 0, size.width, size.height));
+}
+
+void
+Workspace::reserve(std::size_t slot, const cv::Size& size, int type)
+{
+  if (size.width <= 0 || size.height <= 0)
+    return;
+  if (slot >= buffers_.size())
+    buffers_.resize(slot + 1);
+
+  cv::Mat& buffer = buffers_[slot];
+  if (!buffer.empty() && buffer.type() == type
+      && buffer.cols >= size.width && buffer.rows >= size.height)
+    return;
+
+  // Grow in both dimensions so that alternating shapes do not
+  // reallocate forever.
+  cv::Size capacity = size;
+  if (buffer.type() == type)
+    {
+      capacity.width = std::max(capacity.width, buffer.cols);
+      capacity.height = std::max(capacity.height, buffer.rows);
+    }
+  buffer.create(capacity, type);
+  ++allocations_;
+}
+
+std::size_t
+Workspace::allocations() const
+{
+  return allocations_;
+}
@@ -0,0 +1,47 @@
+#include <fstream>
+#include <ros/console.h>
+#include <yaml-cpp/yaml.h>
+#include "libhueblob/yaml_model.hh"
+
+void operator >> (const YAML::Node& node, YamlModel& model) {
+   node["name"] >> model.name;
+   node["path"] >> model.path;
+   if (const YAML::Node* lookup = node.FindValue("lookup"))
+     *lookup >> model.lookup;
+   if (const YAML::Node* algo = node.FindValue("algo"))
+     *algo >> model.algo;
+   model.pyramid_levels = 0;
+   if (const YAML::Node* levels = node.FindValue("pyramid_levels"))
+     *levels >> model.pyramid_levels;
+}
+
+std::vector<YamlModel> readYamlModels(const std::string& filename)
+{
+  std::ifstream fin(filename.c_str());
+  YAML::Parser parser(fin);
+  YAML::Node doc;
+  parser.GetNextDocument(doc);
+
+  std::vector<YamlModel> models(doc.size());
+  for(unsigned i=0;i<doc.size();i++)
+    doc[i] >> models[i];
+  return models;
+}
+
+lookup_t parseLookup(const std::string& lookup)
+{
+  if (lookup == "bgr")
+    return BGR_LOOKUP;
+  if (lookup != "" && lookup != "hsv")
+    ROS_WARN("Unknown lookup %s, falling back to hsv", lookup.c_str());
+  return HSV_LOOKUP;
+}
+
+algo_t parseAlgo(const std::string& algo)
+{
+  if (algo == "naive")
+    return NAIVE;
+  if (algo != "" && algo != "camshift")
+    ROS_WARN("Unknown algorithm %s, falling back to camshift", algo.c_str());
+  return CAMSHIFT;
+}
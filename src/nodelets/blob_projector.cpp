@@ -0,0 +1,336 @@
+#include "blob_projector.h"
+#include <ros/ros.h>
+#include <ros/console.h>
+
+// Msgs
+#include <visualization_msgs/Marker.h>
+#include <hueblob/Blob.h>
+#include <hueblob/Density.h>
+
+#include <pcl_ros/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/features/feature.h>
+#include "pcl/filters/statistical_outlier_removal.h"
+
+#include <Eigen/Dense>
+
+namespace
+{
+
+  /// \brief Share the data of a 32FC1 disparity image.
+  cv::Mat disparityMat(const stereo_msgs::DisparityImage& disparity_image)
+  {
+    const sensor_msgs::Image& image = disparity_image.image;
+    if (image.data.empty())
+      return cv::Mat();
+    return cv::Mat(image.height, image.width, CV_32FC1,
+                   const_cast<unsigned char*>(&image.data[0]), image.step);
+  }
+
+  void get3dCloud(const stereo_msgs::DisparityImage &disparity_image,
+                  Reprojector& reprojector,
+                  std::vector<int>& pixels,
+                  DepthFilter& filter,
+                  const cv::Mat& bgr,
+                  const EllipseMask& mask,
+                  const hueblob::RoiStamped & roi_stamped,
+                  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_raw,
+                  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_filtered,
+                  float& density,
+                  LatencyStage* depth_filter_latency,
+                  LatencyStage* sor_latency
+                  )
+  {
+    const sensor_msgs::RegionOfInterest roi = roi_stamped.roi;
+    const cv::Rect rect(roi.x_offset, roi.y_offset, roi.width, roi.height);
+    unsigned total_points = mask.area();
+    unsigned with_depth_points(0);
+
+    // Reproject every valid pixel into the raw cloud if requested,
+    // otherwise directly into the filtered one, then keep the masked
+    // points in place.
+    pcl::PointCloud<pcl::PointXYZRGB>& cloud =
+      cloud_raw ? *cloud_raw : *cloud_filtered;
+    ROS_ASSERT(disparity_image.max_disparity != 0.0);
+    cv::Mat disparity = disparityMat(disparity_image);
+    cloud.points.clear();
+    if (!disparity.empty())
+      reprojector.project(disparity, rect, cloud.points, &pixels);
+    if (cloud_raw)
+      cloud_filtered->points.reserve(cloud.points.size());
+
+    for (unsigned k = 0; k < cloud.points.size(); ++k)
+      {
+        const int u = pixels[k] / rect.width;
+        const int v = pixels[k] % rect.width;
+        pcl::PointXYZRGB& p = cloud.points[k];
+        const cv::Vec3b& rgb = bgr.at<cv::Vec3b>(u, v);
+        p.r = rgb[2];
+        p.g = rgb[1];
+        p.b = rgb[0];
+        if (!mask.contains(u, v))
+          continue;
+        if (cloud_raw)
+          cloud_filtered->points.push_back(p);
+        else
+          cloud.points[with_depth_points] = p;
+        with_depth_points++;
+      }
+    cloud_filtered->points.resize(with_depth_points);
+    cloud_filtered->width = cloud_filtered->points.size();
+    cloud_filtered->height = 1;
+    cloud_filtered->header = roi_stamped.header;
+    if (cloud_raw)
+      {
+        cloud_raw->width = cloud_raw->points.size();
+        cloud_raw->height = 1;
+        cloud_raw->header = roi_stamped.header;
+      }
+
+    if (filter.method_ != STATISTICAL_FILTER)
+      {
+        LatencyMonitor::Scope timing(depth_filter_latency);
+        if (cloud_raw)
+          {
+            filter.filter(cloud_raw->points);
+            cloud_raw->width = cloud_raw->points.size();
+          }
+        filter.filter(cloud_filtered->points);
+        cloud_filtered->width = cloud_filtered->points.size();
+        density = (float)(with_depth_points)/(float)(total_points);
+        return;
+      }
+
+    LatencyMonitor::Scope timing(sor_latency);
+    static pcl::StatisticalOutlierRemoval<pcl::PointXYZRGB> sor;
+    sor.setMeanK (50);
+    sor.setStddevMulThresh (1.0);
+
+    if (cloud_raw)
+      {
+        sor.setInputCloud (cloud_raw);
+        sor.filter (*cloud_raw);
+      }
+    sor.setInputCloud (cloud_filtered);
+    sor.filter (*cloud_filtered);
+    density = (float)(with_depth_points)/(float)(total_points);
+  }
+
+  /// \brief Accumulate the blob points without building clouds.
+  void get3dStatistics(const stereo_msgs::DisparityImage &disparity_image,
+                       Reprojector& reprojector,
+                       BlobStatistics& statistics,
+                       const EllipseMask& mask,
+                       float& density
+                       )
+  {
+    statistics.reset();
+    cv::Mat disparity = disparityMat(disparity_image);
+    if (!disparity.empty())
+      statistics.add(reprojector, disparity, mask);
+    density = (float)(statistics.points())/(float)(mask.area());
+  }
+
+  /// Timed projection stages, see BlobProjector::setLatency.
+  enum
+  {
+    GET3D_CLOUD_LATENCY,
+    DEPTH_FILTER_LATENCY,
+    SOR_LATENCY,
+    STATISTICS_LATENCY,
+    PUBLISH_3D_LATENCY,
+    END_TO_END_3D_LATENCY,
+    LATENCY_STAGES
+  };
+  static const char* const latency_names[LATENCY_STAGES] =
+    {"get3d_cloud", "depth_filter", "sor", "statistics", "publish_3d",
+     "end_to_end_3d"};
+} // end of anonymous namespace.
+
+namespace hueblob {
+  BlobProjector::BlobProjector()
+    : cloud_pub_(),
+      cloud_filtered_pub_(),
+      marker_pub_(),
+      blob3d_pub_(),
+      transform_pub_(),
+      density_pub_(),
+      br_(),
+      frame_name_(),
+      reprojector_(),
+      pixels_(),
+      filter_(),
+      statistics_(),
+      mask_(),
+      latency_()
+  {
+  }
+
+  void BlobProjector::setLatency(LatencyMonitor* latency)
+  {
+    latency_.clear();
+    if (!latency)
+      return;
+    for (int stage = 0; stage < LATENCY_STAGES; ++stage)
+      latency_.push_back(latency->stage(latency_names[stage]));
+  }
+
+  LatencyStage* BlobProjector::latencyStage(std::size_t stage) const
+  {
+    return latency_.empty() ? 0 : latency_[stage];
+  }
+
+  void BlobProjector::onInit(ros::NodeHandle& nh, ros::NodeHandle& local_nh,
+                             const std::string& name)
+  {
+    local_nh.param("frame_name", frame_name_, std::string("roseball"));
+    // Not validated on recorded bags yet, see the README.
+    std::string depth_filter;
+    local_nh.param("depth_filter", depth_filter, std::string("statistical"));
+    filter_.method_ = parseDepthFilter(depth_filter);
+    local_nh.param("mad_scale", filter_.madScale_, filter_.madScale_);
+    local_nh.param("depth_bin", filter_.binSize_, filter_.binSize_);
+    local_nh.param("depth_gate", filter_.gateWidth_, filter_.gateWidth_);
+
+    const std::string blob3d_topic         = ros::names::resolve("blobs/" + name + "/blob3d");
+    const std::string cloud_topic          = ros::names::resolve("blobs/" + name + "/points_raw");
+    const std::string cloud_filtered_topic = ros::names::resolve("blobs/" + name + "/points");
+    const std::string marker_topic         = ros::names::resolve("blobs/" + name + "/marker");
+    const std::string transform_topic      = ros::names::resolve("blobs/" + name + "/transform");
+    const std::string density_topic        = ros::names::resolve("blobs/" + name + "/density");
+
+    cloud_filtered_pub_  = nh.advertise<pcl::PointCloud<pcl::PointXYZRGB> > (cloud_filtered_topic, 1);
+    marker_pub_ = nh.advertise<visualization_msgs::Marker>  (marker_topic, 1);
+    cloud_pub_  = nh.advertise<pcl::PointCloud<pcl::PointXYZRGB> > (cloud_topic, 1);
+    blob3d_pub_  = nh.advertise<Blob> (blob3d_topic, 1);
+    transform_pub_ = nh.advertise<geometry_msgs::TransformStamped>(transform_topic, 1);
+    density_pub_ = nh.advertise<Density>(density_topic, 1);
+
+    ROS_INFO_STREAM(std::endl
+                    << "Publishing to:"
+                    << "\n\t* " << cloud_topic
+                    << "\n\t* " << cloud_filtered_topic
+                    << "\n\t* " << blob3d_topic
+                    << "\n\t* " << transform_topic
+                    << "\n\t* " << density_topic
+                    );
+  }
+
+  void BlobProjector::project(const sensor_msgs::CameraInfo& info,
+                              const cv::Mat& bgr,
+                              const cv::RotatedRect& rrect,
+                              const stereo_msgs::DisparityImage& disparity,
+                              const RoiStamped& roi_stamped)
+  {
+    ROS_ASSERT(bgr.cols == int(roi_stamped.roi.width)
+               && bgr.rows == int(roi_stamped.roi.height));
+    const sensor_msgs::RegionOfInterest& roi = roi_stamped.roi;
+    mask_.set(rrect, cv::Rect(roi.x_offset, roi.y_offset,
+                              roi.width, roi.height));
+
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_raw;
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_filtered(new pcl::PointCloud<pcl::PointXYZRGB>);
+    // ROS_INFO_STREAM(roi_stamped.roi.x_offset << " " << roi_stamped.roi.y_offset << " "
+    //                 << roi_stamped.roi.width << " " << roi_stamped.roi.height);
+
+    reprojector_.setCamera(info.P[0*4+0], info.P[1*4+1],
+                           info.P[0*4+2], info.P[1*4+2],
+                           disparity.image.width, disparity.image.height);
+    reprojector_.setDisparity(disparity.f * disparity.T,
+                              disparity.min_disparity,
+                              disparity.max_disparity);
+
+    float density(-1.);
+    Eigen::Vector4f centroid (0., 0., 0., 0.);
+    // Clouds are only built for their subscribers: SOR needs them, the
+    // streaming statistics use the histogram filter instead.
+    const bool materialize = cloud_pub_.getNumSubscribers() != 0
+      || cloud_filtered_pub_.getNumSubscribers() != 0;
+    if (!materialize)
+      {
+        // Nobody reads the clouds, only accumulate the blob pixels.
+        LatencyMonitor::Scope timing(latencyStage(STATISTICS_LATENCY));
+        get3dStatistics(disparity, reprojector_, statistics_,
+                        mask_, density);
+        if (statistics_.compute(filter_))
+          centroid << statistics_.centroid_.x, statistics_.centroid_.y,
+            statistics_.centroid_.z, 0.;
+      }
+    else if ( cloud_pub_.getNumSubscribers() != 0)
+      {
+        cloud_raw = pcl::PointCloud<pcl::PointXYZRGB>::Ptr(new pcl::PointCloud<pcl::PointXYZRGB>);
+        {
+          LatencyMonitor::Scope timing(latencyStage(GET3D_CLOUD_LATENCY));
+          get3dCloud(disparity, reprojector_, pixels_, filter_,
+                     bgr, mask_,
+                     roi_stamped,
+                     cloud_raw, cloud_filtered,
+                     density, latencyStage(DEPTH_FILTER_LATENCY),
+                     latencyStage(SOR_LATENCY));
+        }
+        cloud_pub_.publish(cloud_raw);
+      }
+    else
+      {
+        LatencyMonitor::Scope timing(latencyStage(GET3D_CLOUD_LATENCY));
+        get3dCloud(disparity, reprojector_, pixels_, filter_,
+                   bgr, mask_,
+                   roi_stamped,
+                   cloud_raw,
+                   cloud_filtered,
+                   density, latencyStage(DEPTH_FILTER_LATENCY),
+                   latencyStage(SOR_LATENCY));
+      }
+
+    LatencyMonitor::Scope timing(latencyStage(PUBLISH_3D_LATENCY));
+    if (materialize)
+      {
+        cloud_filtered_pub_.publish(cloud_filtered);
+        pcl::compute3DCentroid(*cloud_filtered, centroid);
+      }
+    visualization_msgs::Marker marker;
+    marker.header = roi_stamped.header;
+    marker.type = visualization_msgs::Marker::SPHERE;
+    marker.pose.position.x = centroid[0];
+    marker.pose.position.y = centroid[1];
+    marker.pose.position.z = centroid[2];
+    marker.scale.x = 0.1;
+    marker.scale.y = 0.1;
+    marker.scale.z = 0.1;
+    marker_pub_.publish(marker);
+    tf::Transform transform;
+    transform.setIdentity();
+    transform.setOrigin(tf::Vector3(centroid[0],centroid[1],centroid[2]));
+    br_.sendTransform(tf::StampedTransform(transform, roi_stamped.header.stamp,
+                                           roi_stamped.header.frame_id,
+                                           frame_name_
+                                           )
+                      );
+    Blob blob;
+    blob.cloud_centroid.transform.translation.x = centroid[0];
+    blob.cloud_centroid.transform.translation.y = centroid[1];
+    blob.cloud_centroid.transform.translation.z = centroid[2];
+    blob.cloud_centroid.transform.rotation.x = 0.;
+    blob.cloud_centroid.transform.rotation.y = 0.;
+    blob.cloud_centroid.transform.rotation.z = 0.;
+    blob.cloud_centroid.transform.rotation.w = 1.;
+    blob.cloud_centroid.header = roi_stamped.header;
+    blob.depth_density = density;
+    blob.boundingbox_2d.resize(4);
+    blob.boundingbox_2d[0] = roi_stamped.roi.x_offset;
+    blob.boundingbox_2d[1] = roi_stamped.roi.y_offset;
+    blob.boundingbox_2d[2] = roi_stamped.roi.width;
+    blob.boundingbox_2d[3] = roi_stamped.roi.height;
+
+    Density dm;
+    dm.header = roi_stamped.header;
+    dm.data = density;
+
+    blob.header = roi_stamped.header;
+    blob3d_pub_.publish(blob);
+    transform_pub_.publish(blob.cloud_centroid);
+    density_pub_.publish(dm);
+    if (LatencyStage* end_to_end = latencyStage(END_TO_END_3D_LATENCY))
+      end_to_end->add((ros::Time::now() - roi_stamped.header.stamp).toSec());
+  }
+} // namespace hueblob
@@ -0,0 +1,80 @@
+#ifndef __BLOB_PROJECTOR__
+#define __BLOB_PROJECTOR__
+
+#include <string>
+#include <vector>
+#include <ros/ros.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <stereo_msgs/DisparityImage.h>
+#include <hueblob/RoiStamped.h>
+#include <tf/transform_broadcaster.h>
+
+#include "cv.h"
+
+#include "libhueblob/blob_statistics.hh"
+#include "libhueblob/depth_filter.hh"
+#include "libhueblob/ellipse_mask.hh"
+#include "libhueblob/latency_monitor.hh"
+#include "libhueblob/reprojector.hh"
+
+namespace hueblob {
+  /// Project a tracked blob to 3d and publish the blob 3d outputs
+  /// (points, points_raw, marker, blob3d, transform and density).
+  ///
+  /// Used by the projector nodelet on blob images received from a
+  /// tracker, and by the 3d tracker nodelet on its own tracking results.
+  class BlobProjector
+  {
+  public:
+    BlobProjector();
+
+    /// Read the projection parameters and advertise the outputs of
+    /// blob name.
+    void onInit(ros::NodeHandle& nh, ros::NodeHandle& local_nh,
+                const std::string& name);
+
+    /// Project a blob.
+    ///
+    /// \param bgr blob region of the left image.
+    /// \param rrect tracked rotated rect, the blob is the inscribed
+    ///        ellipse.
+    /// \param roi_stamped blob region in the left image.
+    void project(const sensor_msgs::CameraInfo& info,
+                 const cv::Mat& bgr,
+                 const cv::RotatedRect& rrect,
+                 const stereo_msgs::DisparityImage& disparity,
+                 const RoiStamped& roi_stamped);
+
+    /// Time the projection stages into latency (get3d_cloud,
+    /// depth_filter or sor, statistics, publish_3d and end_to_end_3d,
+    /// from the roi stamp), or nothing if null, the default. The 3d
+    /// names keep them apart from the tracker stages when the monitor
+    /// is shared. The stages are registered here, once.
+    void setLatency(LatencyMonitor* latency);
+
+  private:
+    /// Stage registered by setLatency, null when disabled.
+    LatencyStage* latencyStage(std::size_t stage) const;
+
+    ros::Publisher cloud_pub_, cloud_filtered_pub_;
+    ros::Publisher marker_pub_, blob3d_pub_, transform_pub_, density_pub_;
+
+    tf::TransformBroadcaster br_;
+    std::string frame_name_;
+
+    /// Ray tables, rebuilt when the camera changes.
+    Reprojector reprojector_;
+    /// Pixel of each reprojected point, reused from frame to frame.
+    std::vector<int> pixels_;
+    /// Cloud outlier rejection (depth_filter parameter).
+    DepthFilter filter_;
+    /// Blob statistics when no cloud is subscribed.
+    BlobStatistics statistics_;
+    /// Spans of the blob ellipse, reused from frame to frame.
+    EllipseMask mask_;
+    /// Stages of setLatency, empty when timings are disabled.
+    std::vector<LatencyStage*> latency_;
+  };
+}
+
+#endif
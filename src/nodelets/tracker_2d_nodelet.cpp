@@ -1,7 +1,9 @@
 #include "tracker_2d_nodelet.h"
 #include <ros/ros.h>
 #include <ros/console.h>
+#include "libhueblob/model_cache.hh"
 #include "libhueblob/object.hh"
+#include "libhueblob/yaml_model.hh"
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/RegionOfInterest.h>
 #include <sensor_msgs/image_encodings.h>
@@ -21,6 +23,30 @@
 using namespace std;
 namespace enc = sensor_msgs::image_encodings;
 
+namespace
+{
+  /// \brief Allocate an image message and wrap its data.
+  ///
+  /// The message is filled in place through the returned image, then
+  /// published without any further copy.
+  cv::Mat allocateImage(sensor_msgs::ImagePtr& msg,
+                        const std_msgs::Header& header,
+                        const std::string& encoding,
+                        const cv::Size& size, int type)
+  {
+    msg.reset(new sensor_msgs::Image);
+    msg->header = header;
+    msg->encoding = encoding;
+    msg->height = size.height;
+    msg->width = size.width;
+    msg->step = size.width * CV_ELEM_SIZE(type);
+    msg->data.resize(msg->step * size.height);
+    if (msg->data.empty())
+      return cv::Mat(size, type);
+    return cv::Mat(size, type, &msg->data[0], msg->step);
+  }
+} // end of anonymous namespace.
+
 namespace hueblob {
   Tracker2DNodelet::Tracker2DNodelet()
     : nh_(),
@@ -34,20 +60,48 @@ namespace hueblob {
       model_path_(),
       name_(),
       object_(),
-      cv_ptr_(),
-      hsv_ptr_(new cv_bridge::CvImage),
-      bgr_ptr_(new cv_bridge::CvImage),
-      mono_ptr_(new cv_bridge::CvImage),
+      poly_(),
+      input_(),
       model_ptr_(new cv_bridge::CvImage),
-      new_model_ptr_(new cv_bridge::CvImage)
+      rrect_(),
+      roi_(),
+      models_(),
+      hints_(),
+      report_frames_timer_(),
+      reported_dropped_(),
+      latency_(),
+      latency_pub_(),
+      latency_timer_(),
+      track_latency_(),
+      publish_latency_(),
+      end_to_end_latency_(),
+      worker_()
   {
   }
 
   void Tracker2DNodelet::onInit()
+  {
+    setup();
+
+    const::string image_topic         = ros::names::resolve(image_);
+    sub_.subscribe(it_, image_topic, 5);
+    sub_.registerCallback(boost::bind(&Tracker2DNodelet::imageCallback,
+                                      this, _1));
+    ROS_INFO_STREAM(endl<< "Listening to:"
+                    << "\n\t* " << image_topic
+                    << endl
+                    );
+  }
+
+  void Tracker2DNodelet::setup()
   {
     nh_ = getNodeHandle();
     it_ = image_transport::ImageTransport(nh_);
     object_ = Object();
+    object_.setLatency(&latency_);
+    track_latency_ = latency_.stage("track");
+    publish_latency_ = latency_.stage("publish");
+    end_to_end_latency_ = latency_.stage("end_to_end");
 
     ros::NodeHandle local_nh = getPrivateNodeHandle();
 
@@ -56,26 +110,63 @@ namespace hueblob {
     local_nh.param("name", name_,  std::string("rose"));
     local_nh.param("model", model_path_,
                    std::string("package://hueblob/data/models/ball-rose-3.png"));
+    std::string lookup;
+    local_nh.param("lookup", lookup, std::string("hsv"));
+    object_.lookup_ = parseLookup(lookup);
+    std::string algo;
+    local_nh.param("algo", algo, std::string("camshift"));
+    object_.algo_ = parseAlgo(algo);
+    local_nh.param("roi_gating", object_.roiGating_, false);
+    local_nh.param("roi_margin", object_.roiMargin_, 32);
+    local_nh.param("reacquire_period", object_.reacquirePeriod_, 30);
+    local_nh.param("pyramid_levels", object_.pyramidLevels_, 0);
+    local_nh.param("integral_camshift", object_.integralCamShift_, false);
+    local_nh.param("integral_second_order", object_.integralSecondOrder_,
+                   false);
+    bool latest_frame;
+    local_nh.param("latest_frame", latest_frame, false);
+    if (latest_frame)
+      {
+        worker_.reset(new FrameWorker());
+        report_frames_timer_ =
+          nh_.createWallTimer(ros::WallDuration(30.0),
+                              boost::bind(&Tracker2DNodelet::reportFrames,
+                                          this));
+      }
 
-    // Retrieve model image using resource retriever.
-    resource_retriever::Retriever resourceRetriever;
-    resource_retriever::MemoryResource resource =
-      resourceRetriever.get(model_path_);
-    std::vector<char> data;
-    data.resize(resource.size);
-    for (unsigned i = 0; i < resource.size; ++i)
-      data[i] = resource.data[i];
-    model_ptr_->image = cv::imdecode(cv::Mat (data), 1);
-    if (!model_ptr_->image.data)
-      throw std::runtime_error
-	("failed to load the model image\n"
-	 "please, double check the ~model parameter");
-
-    ROS_INFO_STREAM("Loading " << model_path_ << " to object " << name_);
-    object_.addView(model_ptr_->image);
-    std::cout << image_ << name_;
+    // Use the precompiled model if the cache is up to date and holds
+    // the configured model, the model image is then only decoded if
+    // model_image is subscribed to. As in HueBlob, freshness is checked
+    // first: a stale cache is not even mapped.
+    std::string model_cache;
+    local_nh.param("model_cache", model_cache, std::string(""));
+    bool cached = false;
+    const std::string model_file =
+      model_cache == "" ? std::string() : resolveModelPath(model_path_);
+    std::vector<CachedModel> models;
+    if (!model_file.empty()
+        && modelCacheFresh(model_cache, std::vector<std::string>(1, model_file))
+        && loadModelCache(model_cache, models))
+      {
+        const CachedModel* model = findCachedModel(models, name_, model_file);
+        if (model)
+          {
+            ROS_INFO_STREAM("Loading " << name_ << " from " << model_cache);
+            object_.copyModel(model->object);
+            cached = true;
+          }
+      }
+    if (!cached)
+      {
+        if (model_cache != "")
+          ROS_WARN_STREAM("Model cache " << model_cache << " has no up to date "
+                          << name_ << " model compiled from " << model_path_
+                          << ", run compile_models");
+        ROS_INFO_STREAM("Loading " << model_path_ << " to object " << name_);
+        model_ptr_->image = retrieveModel();
+        object_.addView(model_ptr_->image);
+      }
 
-    const::string image_topic         = ros::names::resolve(image_);
     const::string hint_topic          = ros::names::resolve("blobs/" + name_ + "/hint");
     const::string roi_topic           = ros::names::resolve("blobs/" + name_ + "/roi");
     const::string rrect_topic         = ros::names::resolve("blobs/" + name_ + "/rrect");
@@ -85,6 +176,7 @@ namespace hueblob {
     const::string hsv_image_topic     = ros::names::resolve("blobs/" + name_ + "/hsv_image");
     const::string bgr_image_topic     = ros::names::resolve("blobs/" + name_ + "/bgr_image");
     const::string mono_image_topic    = ros::names::resolve("blobs/" + name_ + "/mono_image");
+    const::string latency_topic       = ros::names::resolve("blobs/" + name_ + "/latency");
 
     roi_pub_ = nh_.advertise<RoiStamped>(roi_topic, 5);
     rrect_pub_ = nh_.advertise<RotatedRectStamped>(rrect_topic, 5);
@@ -93,10 +185,12 @@ namespace hueblob {
     hsv_image_pub_ = it_.advertise(hsv_image_topic, 1);
     bgr_image_pub_ = it_.advertise(bgr_image_topic, 1);
     mono_image_pub_ = it_.advertise(mono_image_topic, 1);
+    latency_pub_ = nh_.advertise<LatencyStats>(latency_topic, 1);
+    latency_timer_ =
+      nh_.createWallTimer(ros::WallDuration(1.0),
+                          boost::bind(&Tracker2DNodelet::publishLatency,
+                                      this));
 
-    sub_.subscribe(it_, image_topic, 5);
-    sub_.registerCallback(boost::bind(&Tracker2DNodelet::imageCallback,
-                                      this, _1));
     new_model_sub_.subscribe(it_, new_model_image_topic, 5);
     new_model_sub_.registerCallback(boost::bind(&Tracker2DNodelet::newModelCallback,
                                       this, _1));
@@ -104,7 +198,6 @@ namespace hueblob {
     hint_sub_ = nh_.subscribe(hint_topic, 5,
                               &Tracker2DNodelet::hintCallback, this);
     ROS_INFO_STREAM(endl<< "Listening to:"
-                    << "\n\t* " << image_topic
                     << "\n\t* " << hint_topic
                     << endl
                     << "Publishing to:"
@@ -114,14 +207,31 @@ namespace hueblob {
                     << "\n\t* " << hsv_image_topic
                     << "\n\t* " << bgr_image_topic
                     << "\n\t* " << mono_image_topic
+                    << "\n\t* " << latency_topic
                     << endl
                     );
   }
 
+  cv::Mat Tracker2DNodelet::retrieveModel() const
+  {
+    // Retrieve model image using resource retriever.
+    resource_retriever::Retriever resourceRetriever;
+    resource_retriever::MemoryResource resource =
+      resourceRetriever.get(model_path_);
+    cv::Mat data(1, resource.size, CV_8UC1, resource.data.get());
+    cv::Mat image = cv::imdecode(data, 1);
+    if (!image.data)
+      throw std::runtime_error
+	("failed to load the model image\n"
+	 "please, double check the ~model parameter");
+    return image;
+  }
+
   void Tracker2DNodelet::hintCallback(const sensor_msgs::RegionOfInterestConstPtr& roi)
   {
+    // Applied by the image thread before tracking the next frame.
     cv::Rect rect(roi->x_offset, roi->y_offset, roi->width, roi->height);
-    object_.setSearchWindow(rect);
+    hints_.post(rect);
     // ROS_INFO_STREAM("Set rect " << rect.x
     //                 << " " << rect.y
     //                 << " " << rect.width
@@ -230,43 +340,123 @@ namespace hueblob {
   void Tracker2DNodelet::newModelCallback(const sensor_msgs::ImageConstPtr&
                                        msg)
   {
+    cv_bridge::CvImagePtr new_model_ptr;
     try
       {
-        new_model_ptr_ = cv_bridge::toCvCopy(msg, enc::BGR8);
+        new_model_ptr = cv_bridge::toCvCopy(msg, enc::BGR8);
       }
     catch (cv_bridge::Exception& e)
       {
         ROS_ERROR("cv_bridge exception: %s", e.what());
         return;
       }
-    object_.clearViews();
-    object_.addView(new_model_ptr_->image);
-    model_ptr_->image = new_model_ptr_->image;
+    // Compile the model here, the image thread only swaps it in
+    // between two frames.
+    boost::shared_ptr<Object> object(new Object());
+    object->addView(new_model_ptr->image);
+    ModelUpdate update;
+    update.object = object;
+    update.image = new_model_ptr->image;
+    models_.post(update);
   }
 
   void Tracker2DNodelet::imageCallback(const sensor_msgs::ImageConstPtr&
                                        msg)
+  {
+    dispatch(boost::bind(&Tracker2DNodelet::trackImage, this, msg));
+  }
+
+  void Tracker2DNodelet::dispatch(const FrameWorker::job_t& job)
+  {
+    // Fresh results matter more than processing every frame: the worker
+    // drops the frames arriving while one is processed.
+    if (worker_)
+      worker_->post(job);
+    else
+      job();
+  }
+
+  void Tracker2DNodelet::reportFrames()
+  {
+    if (!worker_)
+      return;
+    const std::size_t dropped = worker_->dropped();
+    if (dropped != reported_dropped_)
+      ROS_INFO_STREAM(name_ << ": frames processed: " << worker_->processed()
+                      << ", dropped: " << dropped << " ("
+                      << dropped - reported_dropped_
+                      << " since the last report)");
+    else
+      ROS_DEBUG_STREAM(name_ << ": frames processed: " << worker_->processed()
+                       << ", dropped: " << dropped);
+    reported_dropped_ = dropped;
+  }
+
+  void Tracker2DNodelet::publishLatency()
+  {
+    if (latency_pub_.getNumSubscribers() == 0)
+      return;
+    LatencyStats stats;
+    stats.header.stamp = ros::Time::now();
+    latency_.toMessage(stats);
+    latency_pub_.publish(stats);
+  }
+
+  bool Tracker2DNodelet::trackImage(const sensor_msgs::ImageConstPtr& msg)
   {
     static const cv::Scalar white  = CV_RGB(255,255,255);
 
+    // Frame boundary: apply the pending model and hint, if any.
+    ModelUpdate update;
+    if (models_.take(update))
+      {
+        object_.copyModel(*update.object);
+        model_ptr_->image = update.image;
+      }
+    cv::Rect hint;
+    if (hints_.take(hint))
+      object_.setSearchWindow(hint);
+
+    // Share the frame, it is only read: bgr8 messages are not copied,
+    // even less when they come from the same nodelet manager.
     try
       {
-        cv_ptr_ = cv_bridge::toCvCopy(msg, enc::BGR8);
+        input_ = cv_bridge::toCvShare(msg, enc::BGR8);
       }
     catch (cv_bridge::Exception& e)
       {
         ROS_ERROR("cv_bridge exception: %s", e.what());
-        return;
+        return false;
       }
+    const cv::Mat& frame = input_->image;
     if ( model_image_pub_.getNumSubscribers() != 0)
       {
-        model_ptr_->header = cv_ptr_->header;
-        model_ptr_->encoding = cv_ptr_->encoding;
+        if (model_ptr_->image.empty())
+          model_ptr_->image = retrieveModel();
+        model_ptr_->header = msg->header;
+        model_ptr_->encoding = enc::BGR8;
         model_image_pub_.publish(model_ptr_->toImageMsg());
       }
 
+    // The overlay is the only output needing a full frame copy.
+    sensor_msgs::ImagePtr tracked_msg;
+    cv::Mat tracked;
+    if ( tracked_image_pub_.getNumSubscribers() != 0)
+      {
+        tracked = allocateImage(tracked_msg, msg->header, enc::BGR8,
+                                frame.size(), CV_8UC3);
+        frame.copyTo(tracked);
+      }
 
-    boost::optional<cv::RotatedRect> rrect = object_.track(cv_ptr_->image);
+    // A single object shares no HSV conversion: it converts only the
+    // region it tracks, see Object::trackingRegion.
+    boost::optional<cv::RotatedRect> rrect;
+    {
+      LatencyMonitor::Scope timing(track_latency_);
+      rrect = object_.track(frame);
+    }
+    // Everything left is publishing, up to the return.
+    LatencyMonitor::Scope timing(publish_latency_);
     if (!rrect)
       {
         ROS_WARN_THROTTLE(20, "failed to track object");
@@ -274,7 +464,12 @@ namespace hueblob {
         RotatedRectStamped rrect_msg;
         rrect_msg.header = msg->header;
         rrect_pub_.publish(rrect_msg);
-        return;
+        if (tracked_msg)
+          tracked_image_pub_.publish(tracked_msg);
+        if (end_to_end_latency_)
+          end_to_end_latency_->add
+            ((ros::Time::now() - msg->header.stamp).toSec());
+        return false;
       }
     cv::Rect rect = rrect->boundingRect();
 
@@ -289,16 +484,14 @@ namespace hueblob {
     //ROS_WARN_STREAM("Publish" << r);
     rrect_pub_.publish(rrect_msg);
 
-    if ( rrect && tracked_image_pub_.getNumSubscribers() != 0)
-      {
-        draw_rrect(cv_ptr_->image, *rrect, rect, name_);
-      }
-
+    if (tracked_msg)
+      draw_rrect(tracked, *rrect, rect, name_);
 
+    bool blob = false;
     if (0 <= rect.x && 0 <= rect.width &&
-        rect.x + rect.width < cv_ptr_->image.cols &&
+        rect.x + rect.width < frame.cols &&
         0 <= rect.y && 0 <= rect.height &&
-        rect.y + rect.height < cv_ptr_->image.rows)
+        rect.y + rect.height < frame.rows)
       {
 
         RoiStamped r;
@@ -308,40 +501,56 @@ namespace hueblob {
         r.roi.width = rect.width;
         r.roi.height = rect.height;
         r.roi.do_rectify = true;
-
-        hsv_ptr_->header = cv_ptr_->header;
-        hsv_ptr_->encoding = cv_ptr_->encoding;
-        hsv_ptr_->image = object_.imgHSV_(rect);
-
-        bgr_ptr_->header = cv_ptr_->header;
-        bgr_ptr_->encoding = cv_ptr_->encoding;
-        bgr_ptr_->image = cv_ptr_->image(rect);
-
-        mono_ptr_->header = cv_ptr_->header;
-        mono_ptr_->encoding = "mono8";
-        cv::Mat ecc = cv::Mat::zeros(rect.height, rect.width, CV_8UC3);
-
-        vector<cv::Point> poly;
-        int angle = cvRound(rrect->angle);
-        cv::ellipse2Poly(rrect->center - cv::Point2f(float(rect.x),
-                                                     float(rect.y)),
-                         cv::Size(0.5*rrect->size.width,
-                                  0.5*rrect->size.height),
-                         angle, 0, 355, 5, poly);
-        //ROS_INFO_STREAM(poly.size());
-        cv::fillConvexPoly(ecc, &poly[0], poly.size(), white);
-        cv::cvtColor(ecc, mono_ptr_->image, CV_BGR2GRAY);
-
+        roi_ = r;
+        blob = true;
         roi_pub_.publish(r);
-        hsv_image_pub_.publish(hsv_ptr_->toImageMsg());
-        bgr_image_pub_.publish(bgr_ptr_->toImageMsg());
-        mono_image_pub_.publish(mono_ptr_->toImageMsg());
-      }
-
 
+        // Each blob image is only built if it is subscribed to.
+        // Published images are filled in place and never copied again.
+        if (hsv_image_pub_.getNumSubscribers() != 0)
+          {
+            sensor_msgs::ImagePtr hsv_msg;
+            cv::Mat hsv_blob = allocateImage(hsv_msg, msg->header, enc::BGR8,
+                                             rect.size(), CV_8UC3);
+            cv::cvtColor(frame(rect), hsv_blob, CV_BGR2HSV);
+            hsv_image_pub_.publish(hsv_msg);
+          }
+
+        if (bgr_image_pub_.getNumSubscribers() != 0)
+          {
+            sensor_msgs::ImagePtr bgr_msg;
+            frame(rect).copyTo(allocateImage(bgr_msg, msg->header, enc::BGR8,
+                                      rect.size(), CV_8UC3));
+            bgr_image_pub_.publish(bgr_msg);
+          }
+
+        // The 3d outputs only need the ellipse parameters, see
+        // EllipseMask: the mask is only rasterized for display.
+        rrect_ = *rrect;
+        if (mono_image_pub_.getNumSubscribers() != 0)
+          {
+            sensor_msgs::ImagePtr mono_msg;
+            cv::Mat mono = allocateImage(mono_msg, msg->header, enc::MONO8,
+                                         rect.size(), CV_8UC1);
+            mono.setTo(0);
+            poly_.clear();
+            int angle = cvRound(rrect->angle);
+            cv::ellipse2Poly(rrect->center - cv::Point2f(float(rect.x),
+                                                         float(rect.y)),
+                             cv::Size(0.5*rrect->size.width,
+                                      0.5*rrect->size.height),
+                             angle, 0, 355, 5, poly_);
+            //ROS_INFO_STREAM(poly_.size());
+            cv::fillConvexPoly(mono, &poly_[0], poly_.size(), white);
+            mono_image_pub_.publish(mono_msg);
+          }
+      }
 
-    if ( tracked_image_pub_.getNumSubscribers() != 0)
-      tracked_image_pub_.publish(cv_ptr_->toImageMsg());
+    if (tracked_msg)
+      tracked_image_pub_.publish(tracked_msg);
+    if (end_to_end_latency_)
+      end_to_end_latency_->add((ros::Time::now() - msg->header.stamp).toSec());
+    return blob;
   }
 } // namespace hueblob
 
@@ -3,6 +3,10 @@
 
 #include <ros/ros.h>
 #include <ros/console.h>
+#include <boost/scoped_ptr.hpp>
+#include "libhueblob/frame_worker.hh"
+#include "libhueblob/latency_monitor.hh"
+#include "libhueblob/mailbox.hh"
 #include "libhueblob/object.hh"
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/RegionOfInterest.h>
@@ -38,15 +42,35 @@ namespace hueblob {
       static void draw_message(cv::Mat im, const cv::RotatedRect &  rrect,
                                    const cv::Rect & rect,
                                       const std::string & name);
+    protected:
+      /// Read the parameters, load the model, advertise the outputs and
+      /// subscribe to hints and new models, but not to images.
+      void setup();
+      /// Track the object in an image and publish the 2d outputs.
+      ///
+      /// \return true if the blob has been found in the image, see
+      ///         roi_ and rrect_, the blob pixels being roi_ in input_.
+      bool trackImage(const sensor_msgs::ImageConstPtr& image);
+      /// Process a frame at once, or hand it to the frame worker if the
+      /// latest_frame parameter is set.
+      void dispatch(const FrameWorker::job_t& job);
+
     private:
       void imageCallback(const sensor_msgs::ImageConstPtr& image);
+      /// Log the frame worker counters.
+      void reportFrames();
+      /// Publish the stage latencies, if subscribed.
+      void publishLatency();
       void newModelCallback(const sensor_msgs::ImageConstPtr& image);
       void hintCallback(const sensor_msgs::RegionOfInterestConstPtr& roi);
       virtual void onInit();
+      /// Decode the model image given by the model parameter.
+      cv::Mat retrieveModel() const;
 
 
       static bool rotated_rect(cv::Mat im, const cv::RotatedRect & rrect, cv::Scalar color);
 
+    protected:
       ros::NodeHandle nh_;
       image_transport::ImageTransport it_;
       image_transport::SubscriberFilter sub_, new_model_sub_;
@@ -56,7 +80,48 @@ namespace hueblob {
       image_transport::Publisher hsv_image_pub_, bgr_image_pub_, mono_image_pub_;
       std::string image_, model_path_, name_;
       Object object_;
-      cv_bridge::CvImagePtr cv_ptr_, hsv_ptr_, bgr_ptr_, mono_ptr_, model_ptr_, new_model_ptr_;
+      std::vector<cv::Point> poly_;
+      /// Current frame, shared with the received message.
+      cv_bridge::CvImageConstPtr input_;
+      cv_bridge::CvImagePtr model_ptr_;
+
+      /// \name Blob of the last trackImage call
+      ///
+      /// No view on image data is kept here: views only live as long
+      /// as the message or buffer they refer to, consumers take the
+      /// blob pixels from input_, which they share.
+      /// \{
+      /// Tracked rotated rect, the blob is the inscribed ellipse.
+      cv::RotatedRect rrect_;
+      RoiStamped roi_;
+      /// \}
+
+      /// Model compiled by newModelCallback, and its image.
+      struct ModelUpdate
+      {
+        boost::shared_ptr<const Object> object;
+        cv::Mat image;
+      };
+      /// Models and hints are only applied by the image thread, at frame
+      /// boundaries.
+      Mailbox<ModelUpdate> models_;
+      Mailbox<cv::Rect> hints_;
+
+      ros::WallTimer report_frames_timer_;
+      std::size_t reported_dropped_;
+
+      /// Stage timings: track, publish and end_to_end, from the image
+      /// stamp. The tracker stages are timed by object_.
+      LatencyMonitor latency_;
+      ros::Publisher latency_pub_;
+      ros::WallTimer latency_timer_;
+      /// Stages of latency_, registered by setup.
+      LatencyStage* track_latency_;
+      LatencyStage* publish_latency_;
+      LatencyStage* end_to_end_latency_;
+      /// Thread processing the newest frame only (latest_frame), declared
+      /// last so that it stops before the state it uses is destroyed.
+      boost::scoped_ptr<FrameWorker> worker_;
     };
 }
 
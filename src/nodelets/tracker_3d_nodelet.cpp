@@ -0,0 +1,132 @@
+#include "tracker_3d_nodelet.h"
+#include <ros/ros.h>
+#include <ros/console.h>
+
+#include <algorithm>
+#include <image_transport/camera_common.h>
+
+using namespace std;
+
+namespace hueblob {
+  Tracker3DNodelet::Tracker3DNodelet()
+    : Tracker2DNodelet(),
+      camera_info_sub_(),
+      disparity_sub_(),
+      exact_sync_(5),
+      approximate_sync_(5),
+      projector_(),
+      pipeline_()
+  {
+  }
+
+  void Tracker3DNodelet::onInit()
+  {
+    setup();
+    ros::NodeHandle local_nh = getPrivateNodeHandle();
+    projector_.onInit(nh_, local_nh, name_);
+    projector_.setLatency(&latency_);
+
+    bool approximate_sync;
+    local_nh.param("approximate_sync", approximate_sync, false);
+    bool pipeline;
+    int pipeline_queue;
+    local_nh.param("pipeline", pipeline, false);
+    local_nh.param("pipeline_queue", pipeline_queue, 2);
+    if (pipeline)
+      {
+        // Frames are pushed as long as tracking keeps up, the
+        // subscriber queues drop the oldest ones otherwise.
+        if (worker_)
+          {
+            ROS_WARN("latest_frame is ignored when pipeline is set");
+            worker_.reset();
+          }
+        std::vector<Pipeline<frame_t>::stage_t> stages;
+        stages.push_back(boost::bind(&Tracker3DNodelet::trackFrame, this, _1));
+        stages.push_back(boost::bind(&Tracker3DNodelet::projectFrame,
+                                     this, _1));
+        pipeline_.reset(new Pipeline<frame_t>(stages,
+                                               std::max(pipeline_queue, 1)));
+      }
+
+    const::string image_topic       = ros::names::resolve(image_);
+    const::string camera_info_topic =
+      image_transport::getCameraInfoTopic(image_topic);
+    const::string disparity_topic   = ros::names::resolve("disparity");
+
+    sub_.subscribe(it_, image_topic, 5);
+    camera_info_sub_.subscribe(nh_, camera_info_topic, 5);
+    disparity_sub_.subscribe(nh_, disparity_topic, 5);
+    if (approximate_sync)
+      {
+        approximate_sync_.connectInput(sub_, camera_info_sub_, disparity_sub_);
+        approximate_sync_.registerCallback
+          (boost::bind(&Tracker3DNodelet::callback, this, _1, _2, _3));
+      }
+    else
+      {
+        exact_sync_.connectInput(sub_, camera_info_sub_, disparity_sub_);
+        exact_sync_.registerCallback
+          (boost::bind(&Tracker3DNodelet::callback, this, _1, _2, _3));
+      }
+
+    ROS_INFO_STREAM(endl<< "Listening to:"
+                    << "\n\t* " << image_topic
+                    << "\n\t* " << camera_info_topic
+                    << "\n\t* " << disparity_topic
+                    << endl
+                    );
+  }
+
+  void Tracker3DNodelet::callback(const sensor_msgs::ImageConstPtr& image,
+                                  const sensor_msgs::CameraInfoConstPtr& info,
+                                  const stereo_msgs::DisparityImageConstPtr&
+                                  disparity)
+  {
+    frame_t frame(new Frame());
+    frame->image = image;
+    frame->info = info;
+    frame->disparity = disparity;
+    frame->tracked = false;
+    if (pipeline_)
+      pipeline_->push(frame);
+    else
+      dispatch(boost::bind(&Tracker3DNodelet::processFrame, this, frame));
+  }
+
+  void Tracker3DNodelet::processFrame(frame_t frame)
+  {
+    trackFrame(frame);
+    projectFrame(frame);
+  }
+
+  void Tracker3DNodelet::trackFrame(frame_t& frame)
+  {
+    // Only the shared input is handed to the projection, with the
+    // blob parameters: no view outlives the buffer it refers to.
+    frame->tracked = trackImage(frame->image);
+    if (!frame->tracked)
+      return;
+    frame->input = input_;
+    frame->rrect = rrect_;
+    frame->roi = roi_;
+  }
+
+  void Tracker3DNodelet::projectFrame(frame_t& frame)
+  {
+    if (!frame->tracked)
+      return;
+    const sensor_msgs::RegionOfInterest& roi = frame->roi.roi;
+    const cv::Mat bgr =
+      frame->input->image(cv::Rect(roi.x_offset, roi.y_offset,
+                                   roi.width, roi.height));
+    projector_.project(*frame->info, bgr, frame->rrect,
+                       *frame->disparity, frame->roi);
+  }
+} // namespace hueblob
+
+
+#include <pluginlib/class_list_macros.h>
+
+PLUGINLIB_DECLARE_CLASS(hueblob, tracker_3d,
+                        hueblob::Tracker3DNodelet, nodelet::Nodelet)
@@ -0,0 +1,91 @@
+#ifndef __TRACKER_3D_NODELET__
+#define __TRACKER_3D_NODELET__
+
+#include "blob_projector.h"
+#include "tracker_2d_nodelet.h"
+#include "libhueblob/pipeline.hh"
+
+#include <sensor_msgs/CameraInfo.h>
+#include <stereo_msgs/DisparityImage.h>
+#include <message_filters/subscriber.h>
+#include <message_filters/sync_policies/exact_time.h>
+#include <message_filters/sync_policies/approximate_time.h>
+#include <message_filters/synchronizer.h>
+
+
+namespace hueblob {
+  /// Track a blob and project it to 3d in a single callback.
+  ///
+  /// Equivalent to a tracker_2d nodelet feeding a projector nodelet,
+  /// with the same output topics, but the tracking results are handed
+  /// to the projection directly: blob images are neither serialized
+  /// nor re-synchronized with the disparity. Use the split pipeline
+  /// only when the two stages run on separate hosts.
+  ///
+  /// With the pipeline parameter, tracking and projection run in
+  /// their own threads: a frame is tracked while the previous one is
+  /// projected.
+  class Tracker3DNodelet : public Tracker2DNodelet
+    {
+    public:
+      Tracker3DNodelet();
+      /// Stop the frame threads before the projector is destroyed.
+      virtual ~Tracker3DNodelet(){ pipeline_.reset(); worker_.reset(); };
+
+    private:
+      virtual void onInit();
+      void callback(const sensor_msgs::ImageConstPtr& image,
+                    const sensor_msgs::CameraInfoConstPtr& info,
+                    const stereo_msgs::DisparityImageConstPtr& disparity);
+
+      /// Inputs and tracking results of a frame.
+      struct Frame
+      {
+        sensor_msgs::ImageConstPtr image;
+        sensor_msgs::CameraInfoConstPtr info;
+        stereo_msgs::DisparityImageConstPtr disparity;
+        bool tracked;
+        /// Blob, see trackImage. The frame owns input, the blob
+        /// pixels are only taken from it by the projection.
+        cv_bridge::CvImageConstPtr input;
+        cv::RotatedRect rrect;
+        RoiStamped roi;
+      };
+      typedef boost::shared_ptr<Frame> frame_t;
+
+      void processFrame(frame_t frame);
+      /// \name Frame stages
+      ///
+      /// Tracking is a single stage, see HueBlob::trackFrame: each
+      /// frame likelihood depends on the previous frame window.
+      /// \{
+      void trackFrame(frame_t& frame);
+      void projectFrame(frame_t& frame);
+      /// \}
+
+      typedef message_filters::sync_policies::ExactTime<
+        sensor_msgs::Image,
+        sensor_msgs::CameraInfo,
+        stereo_msgs::DisparityImage
+        > ExactPolicy;
+      typedef message_filters::sync_policies::ApproximateTime<
+        sensor_msgs::Image,
+        sensor_msgs::CameraInfo,
+        stereo_msgs::DisparityImage
+        > ApproximatePolicy;
+      typedef message_filters::Synchronizer<ExactPolicy> ExactSync;
+      typedef message_filters::Synchronizer<ApproximatePolicy> ApproximateSync;
+
+      message_filters::Subscriber<sensor_msgs::CameraInfo> camera_info_sub_;
+      message_filters::Subscriber<stereo_msgs::DisparityImage> disparity_sub_;
+      ExactSync exact_sync_;
+      ApproximateSync approximate_sync_;
+
+      BlobProjector projector_;
+      /// Tracking and projection threads (pipeline), declared last so
+      /// that they stop before the projector is destroyed.
+      boost::scoped_ptr<Pipeline<frame_t> > pipeline_;
+    };
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <stereo_msgs/DisparityImage.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/features/feature.h>
+#include "pcl/filters/statistical_outlier_removal.h"
+#include <Eigen/Dense>
+
+#include "libhueblob/depth_filter.hh"
+#include "libhueblob/reprojector.hh"
+
+namespace
+{
+  typedef pcl::PointCloud<pcl::PointXYZ> cloud_t;
+
+  /// \brief Accuracy and cost of a filter, relative to SOR.
+  struct Score
+  {
+    Score() : seconds(), kept(), error(), frames() {}
+    double seconds;
+    double kept;
+    double error;
+    unsigned frames;
+  };
+
+  void report(const std::string& name, const Score& score)
+  {
+    if (!score.frames)
+      return;
+    boost::format fmt("%-12s %8.3f ms %8.1f points %8.4f m");
+    fmt % name % (1e3 * score.seconds / score.frames)
+      % (score.kept / score.frames) % (score.error / score.frames);
+    std::cout << fmt << std::endl;
+  }
+
+  Eigen::Vector4f centroid(const cloud_t& cloud)
+  {
+    Eigen::Vector4f result(0., 0., 0., 0.);
+    if (!cloud.points.empty())
+      pcl::compute3DCentroid(cloud, result);
+    return result;
+  }
+} // end of anonymous namespace.
+
+/// \brief Compare the blob cloud outlier rejection methods on a bag.
+///
+/// Usage: benchmark_depth_filters BAG [X Y WIDTH HEIGHT]
+///
+/// Each disparity image of the bag is reprojected over the given
+/// region (the centered quarter of the image by default) as done for
+/// a blob, then filtered by PCL StatisticalOutlierRemoval, the MAD
+/// filter and the histogram filter (see DepthFilter). Reported per
+/// frame: filtering time, points kept and centroid distance to the SOR
+/// centroid.
+int main(int argc, char **argv)
+{
+  if (argc != 2 && argc != 6)
+    {
+      std::cerr << "Usage: " << argv[0] << " BAG [X Y WIDTH HEIGHT]"
+		<< std::endl;
+      return 1;
+    }
+  ros::Time::init();
+
+  rosbag::Bag bag;
+  try
+    {
+      bag.open(argv[1], rosbag::bagmode::Read);
+    }
+  catch(rosbag::BagException& e)
+    {
+      std::cerr << argv[1] << ": " << e.what() << std::endl;
+      return 1;
+    }
+
+  Reprojector reprojector;
+  DepthFilter mad;
+  mad.method_ = MAD_FILTER;
+  DepthFilter histogram;
+  histogram.method_ = HISTOGRAM_FILTER;
+  Score sorScore, madScore, histogramScore;
+  sensor_msgs::CameraInfoConstPtr camera;
+
+  rosbag::View view(bag);
+  BOOST_FOREACH(const rosbag::MessageInstance& message, view)
+    {
+      // Only the left camera info is used for the projection.
+      sensor_msgs::CameraInfoConstPtr info =
+	message.instantiate<sensor_msgs::CameraInfo>();
+      if (info && message.getTopic().find("right") == std::string::npos)
+	camera = info;
+      stereo_msgs::DisparityImageConstPtr disparity =
+	message.instantiate<stereo_msgs::DisparityImage>();
+      if (!disparity || !camera || disparity->image.data.empty())
+	continue;
+
+      const sensor_msgs::Image& image = disparity->image;
+      cv::Mat disparityMat(image.height, image.width, CV_32FC1,
+			   const_cast<unsigned char*>(&image.data[0]),
+			   image.step);
+      cv::Rect rect(image.width / 4, image.height / 4,
+		    image.width / 2, image.height / 2);
+      if (argc == 6)
+	rect = cv::Rect(std::atoi(argv[2]), std::atoi(argv[3]),
+			std::atoi(argv[4]), std::atoi(argv[5]));
+
+      reprojector.setCamera(camera->P[0 * 4 + 0], camera->P[1 * 4 + 1],
+			    camera->P[0 * 4 + 2], camera->P[1 * 4 + 2],
+			    image.width, image.height);
+      reprojector.setDisparity(disparity->f * disparity->T,
+			       disparity->min_disparity,
+			       disparity->max_disparity);
+      cloud_t::Ptr cloud(new cloud_t);
+      reprojector.project(disparityMat, rect, cloud->points);
+      cloud->width = cloud->points.size();
+      cloud->height = 1;
+      if (cloud->points.empty())
+	continue;
+
+      cloud_t reference;
+      ros::WallTime start = ros::WallTime::now();
+      pcl::StatisticalOutlierRemoval<pcl::PointXYZ> sor;
+      sor.setInputCloud(cloud);
+      sor.setMeanK(50);
+      sor.setStddevMulThresh(1.0);
+      sor.filter(reference);
+      sorScore.seconds += (ros::WallTime::now() - start).toSec();
+      sorScore.kept += reference.points.size();
+      ++sorScore.frames;
+      const Eigen::Vector4f expected = centroid(reference);
+
+      DepthFilter* filters[] = {&mad, &histogram};
+      Score* scores[] = {&madScore, &histogramScore};
+      for (unsigned i = 0; i < 2; ++i)
+	{
+	  cloud_t filtered(*cloud);
+	  start = ros::WallTime::now();
+	  filters[i]->filter(filtered.points);
+	  scores[i]->seconds += (ros::WallTime::now() - start).toSec();
+	  scores[i]->kept += filtered.points.size();
+	  scores[i]->error += (centroid(filtered) - expected).norm();
+	  ++scores[i]->frames;
+	}
+    }
+  bag.close();
+
+  report("statistical", sorScore);
+  report("mad", madScore);
+  report("histogram", histogramScore);
+  return 0;
+}
@@ -0,0 +1,55 @@
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <highgui.h>
+#include <yaml-cpp/yaml.h>
+
+#include "libhueblob/model_cache.hh"
+#include "libhueblob/yaml_model.hh"
+
+/// \brief Build a model cache from a models list.
+///
+/// Usage: compile_models MODELS.yaml CACHE
+///
+/// The cache is then given to the hueblob node (~model_cache) or the
+/// tracker nodelet (model_cache) to skip image decoding and histogram
+/// computation at startup.
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+    {
+      std::cerr << "Usage: " << argv[0] << " MODELS.yaml CACHE" << std::endl;
+      return 1;
+    }
+
+  try
+    {
+      std::vector<YamlModel> yaml_models = readYamlModels(argv[1]);
+      std::vector<CachedModel> models(yaml_models.size());
+      for (unsigned i = 0; i < yaml_models.size(); ++i)
+	{
+	  cv::Mat view = cv::imread(yaml_models[i].path);
+	  if (!view.data)
+	    {
+	      std::cerr << "failed to load " << yaml_models[i].path << std::endl;
+	      return 1;
+	    }
+	  models[i].name = yaml_models[i].name;
+	  models[i].path = yaml_models[i].path;
+	  models[i].object.addView(view);
+	  std::cout << "Compiled " << models[i].name << std::endl;
+	}
+      saveModelCache(argv[2], models);
+    }
+  catch(YAML::Exception& e)
+    {
+      std::cerr << argv[1] << ": " << e.what() << std::endl;
+      return 1;
+    }
+  catch(std::runtime_error& e)
+    {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  return 0;
+}
@@ -1,10 +1,30 @@
+#include <boost/bind.hpp>
 #include <boost/format.hpp>
 #include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <gtest/gtest.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "libhueblob/blob_statistics.hh"
+#include "libhueblob/depth_filter.hh"
+#include "libhueblob/ellipse_mask.hh"
+#include "libhueblob/frame_worker.hh"
+#include "libhueblob/label_engine.hh"
+#include "libhueblob/latency_monitor.hh"
+#include "libhueblob/mailbox.hh"
+#include "libhueblob/model_cache.hh"
+#include "libhueblob/object_registry.hh"
 #include "libhueblob/object.hh"
+#include "libhueblob/pipeline.hh"
+#include "libhueblob/reprojector.hh"
+#include <limits>
+#include <stdexcept>
 #include <vector>
 
 void trackObject(std::vector<std::string> viewFilenames,
@@ -21,7 +41,7 @@ void trackObject(std::vector<std::string> viewFilenames,
       object.addView(view);
     }
 
-  EXPECT_EQ(object.modelHistogram.size(), viewFilenames.size());
+  EXPECT_EQ(object.modelHistogram_.size(), viewFilenames.size());
 
   cv::Mat image = cv::imread(frameFilename + ".png");
   boost::optional<cv::RotatedRect> rrect = object.track(image);
@@ -80,12 +100,12 @@ void addView(const std::string& viewFilename)
   cv::Mat img = cv::imread(viewFilename + ".png");
   object.addView(img);
 
-  EXPECT_EQ(object.modelHistogram.size(), 1u);
+  EXPECT_EQ(object.modelHistogram_.size(), 1u);
 
   static int i = 0;
   boost::format filename("hist_%d.png");
   filename % i++;
-  viewHistogram(object.modelHistogram[0], filename.str());
+  viewHistogram(object.modelHistogram_[0], filename.str());
 }
 
 void computeMask(const std::string& filename)
@@ -101,18 +121,92 @@ void computeMask(const std::string& filename)
     std::cerr << "Failed to save image.";
 }
 
+void compiledModel(std::vector<std::string> viewFilenames,
+		   const std::string& frameFilename)
+{
+  static const float hue_range[] = { 0, 250 };
+  static const float sat_range[] = { 0, 250 };
+  static const float* ranges[] = { hue_range, sat_range };
+  int channels[] = {0, 1};
+
+  Object object;
+  for (unsigned i = 0; i < viewFilenames.size(); ++i)
+    object.addView(cv::imread(viewFilenames[i] + ".png"));
+
+  cv::Mat image = cv::imread(frameFilename + ".png");
+  cv::Mat hsv;
+  cv::cvtColor(image, hsv, CV_BGR2HSV);
+
+  // Reference: one back projection per view, saturated merge.
+  cv::Mat expected = cv::Mat::zeros(image.size(), CV_8U);
+  cv::Mat backProject;
+  for (unsigned i = 0; i < object.modelHistogram_.size(); ++i)
+    {
+      cv::calcBackProject(&hsv, 1, channels, object.modelHistogram_[i],
+			  backProject, ranges);
+      cv::add(expected, backProject, expected);
+    }
+
+  cv::calcBackProject(&hsv, 1, channels, object.compiledHistogram_,
+		      backProject, ranges);
+  EXPECT_EQ(cv::countNonZero(expected != backProject), 0);
+}
+
+void compareLookups(const std::string& viewFilename,
+		    const std::string& frameFilename)
+{
+  static const int iterations = 20;
+  cv::Mat view = cv::imread(viewFilename + ".png");
+  cv::Mat image = cv::imread(frameFilename + ".png");
+
+  Object hsv;
+  hsv.addView(view);
+  Object bgr;
+  bgr.lookup_ = BGR_LOOKUP;
+  bgr.addView(view);
+
+  double hsvTicks = 0., bgrTicks = 0.;
+  boost::optional<cv::RotatedRect> hsvRrect, bgrRrect;
+  for (int i = 0; i < iterations; ++i)
+    {
+      int64 start = cv::getTickCount();
+      hsvRrect = hsv.track(image);
+      int64 middle = cv::getTickCount();
+      bgrRrect = bgr.track(image);
+      hsvTicks += middle - start;
+      bgrTicks += cv::getTickCount() - middle;
+    }
+
+  ASSERT_TRUE(hsvRrect);
+  ASSERT_TRUE(bgrRrect);
+
+  // Both lookups must agree on where the object is.
+  cv::Rect hsvRect = hsvRrect->boundingRect();
+  cv::Rect bgrRect = bgrRrect->boundingRect();
+  double overlap = (hsvRect & bgrRect).area();
+  double area = (hsvRect | bgrRect).area();
+  EXPECT_GT(overlap / area, 0.5);
+
+  boost::format fmt("%s: hsv %.3f ms, bgr %.3f ms, overlap %.2f");
+  fmt % frameFilename
+    % (1e3 * hsvTicks / cv::getTickFrequency() / iterations)
+    % (1e3 * bgrTicks / cv::getTickFrequency() / iterations)
+    % (overlap / area);
+  std::cout << fmt << std::endl;
+}
 
 // Misc. tests.
 TEST(TestSuite, simple)
 {
   Object object;
 
-  EXPECT_EQ(object.anchor_x, 0.);
-  EXPECT_EQ(object.anchor_y, 0.);
-  EXPECT_EQ(object.anchor_z, 0.);
+  EXPECT_EQ(object.anchor_x_, 0.);
+  EXPECT_EQ(object.anchor_y_, 0.);
+  EXPECT_EQ(object.anchor_z_, 0.);
 
-  EXPECT_TRUE(object.modelHistogram.empty());
-  EXPECT_EQ(object.modelHistogram.size(), 0u);
+  EXPECT_TRUE(object.modelHistogram_.empty());
+  EXPECT_EQ(object.modelHistogram_.size(), 0u);
+  EXPECT_TRUE(object.compiledHistogram_.empty());
 }
 
 
@@ -202,6 +296,652 @@ TEST(TestSuite, track_ball_orange2)
   trackObject(ball_orange_models,"./data/frames/ball-orange-frame");
 }
 
+// Model compilation tests.
+TEST(TestSuite, compiled_model_ball_rose)
+{
+  std::vector<std::string> ball_rose_models;
+  ball_rose_models.push_back("./data/models/ball-rose");
+  ball_rose_models.push_back("./data/models/ball-rose-2");
+  ball_rose_models.push_back("./data/models/ball-rose-3");
+  compiledModel(ball_rose_models, "./data/frames/ball-rose-frame");
+}
+
+TEST(TestSuite, compiled_model_clear_views)
+{
+  Object object;
+  object.addView(cv::imread("./data/models/ball-orange.png"));
+  EXPECT_FALSE(object.compiledHistogram_.empty());
+  object.clearViews();
+  EXPECT_TRUE(object.compiledHistogram_.empty());
+  EXPECT_FALSE(object.track(cv::imread("./data/frames/ball-orange-frame.png")));
+}
+
+// Lookup benchmark: BGR cube against HSV back projection.
+TEST(TestSuite, lookup_door)
+{
+  compareLookups("./data/models/door", "./data/frames/door-frame");
+}
+
+TEST(TestSuite, lookup_ball_rose)
+{
+  compareLookups("./data/models/ball-rose", "./data/frames/ball-rose-frame");
+}
+
+TEST(TestSuite, lookup_ball_orange)
+{
+  compareLookups("./data/models/ball-orange",
+		 "./data/frames/ball-orange-frame");
+}
+
+// ROI gating: once the object is found, gated tracking must stay on it.
+TEST(TestSuite, roi_gating_ball_orange)
+{
+  cv::Mat view = cv::imread("./data/models/ball-orange.png");
+  cv::Mat image = cv::imread("./data/frames/ball-orange-frame.png");
+
+  Object full;
+  full.addView(view);
+  Object gated;
+  gated.roiGating_ = true;
+  gated.addView(view);
+
+  for (int i = 0; i < 3; ++i)
+    {
+      boost::optional<cv::RotatedRect> expected = full.track(image);
+      boost::optional<cv::RotatedRect> rrect = gated.track(image);
+      ASSERT_TRUE(expected);
+      ASSERT_TRUE(rrect);
+      EXPECT_NEAR(rrect->center.x, expected->center.x, 2.);
+      EXPECT_NEAR(rrect->center.y, expected->center.y, 2.);
+    }
+  EXPECT_LT(gated.likelihood_.total(), full.likelihood_.total());
+}
+
+// Tracking restricted to a band of rows, as done along epipolar lines.
+TEST(TestSuite, track_area_ball_orange)
+{
+  cv::Mat view = cv::imread("./data/models/ball-orange.png");
+  cv::Mat image = cv::imread("./data/frames/ball-orange-frame.png");
+
+  Object full;
+  full.addView(view);
+  boost::optional<cv::RotatedRect> expected = full.track(image);
+  ASSERT_TRUE(expected);
+  cv::Rect blob = expected->boundingRect();
+
+  Object band;
+  band.addView(view);
+  cv::Rect area(0, blob.y - 10, image.cols, blob.height + 20);
+  boost::optional<cv::RotatedRect> rrect = band.track(image, cv::Mat(), area);
+  ASSERT_TRUE(rrect);
+  EXPECT_NEAR(rrect->center.x, expected->center.x, 2.);
+  EXPECT_NEAR(rrect->center.y, expected->center.y, 2.);
+  EXPECT_LE(band.likelihood_.rows, area.height);
+
+  // Tracking is confined to the area: above the blob rows, the frame
+  // may still hold a few pixels of the object colors, but the search
+  // never reaches the blob and whatever is found lies in the area.
+  Object outside;
+  outside.addView(view);
+  cv::Rect above(0, 0, image.cols, std::max(blob.y - 10, 0));
+  boost::optional<cv::RotatedRect> found =
+    outside.track(image, cv::Mat(), above);
+  EXPECT_LE(outside.likelihood_.rows, above.height);
+  if (found)
+    EXPECT_LE(found->boundingRect().y + found->boundingRect().height,
+	      above.height + 1);
+}
+
+// Coarse to fine tracking of a large object.
+TEST(TestSuite, pyramid_door)
+{
+  cv::Mat view = cv::imread("./data/models/door.png");
+  cv::Mat image = cv::imread("./data/frames/door-frame.png");
+
+  Object full;
+  full.addView(view);
+  Object pyramid;
+  pyramid.pyramidLevels_ = 2;
+  pyramid.addView(view);
+
+  boost::optional<cv::RotatedRect> expected = full.track(image);
+  boost::optional<cv::RotatedRect> rrect = pyramid.track(image);
+  ASSERT_TRUE(expected);
+  ASSERT_TRUE(rrect);
+
+  cv::Rect expectedRect = expected->boundingRect();
+  cv::Rect rect = rrect->boundingRect();
+  EXPECT_GT(double((rect & expectedRect).area())
+	    / (rect | expectedRect).area(), 0.5);
+}
+
+// Integral images CamShift must agree with cv::CamShift.
+void integralCamShift(const std::string& viewFilename,
+		      const std::string& frameFilename,
+		      bool secondOrder)
+{
+  cv::Mat view = cv::imread(viewFilename + ".png");
+  cv::Mat image = cv::imread(frameFilename + ".png");
+
+  Object reference;
+  reference.addView(view);
+  Object integral;
+  integral.integralCamShift_ = true;
+  integral.integralSecondOrder_ = secondOrder;
+  integral.addView(view);
+
+  boost::optional<cv::RotatedRect> expected = reference.track(image);
+  boost::optional<cv::RotatedRect> rrect = integral.track(image);
+  ASSERT_TRUE(expected);
+  ASSERT_TRUE(rrect);
+  EXPECT_NEAR(rrect->center.x, expected->center.x, 1.);
+  EXPECT_NEAR(rrect->center.y, expected->center.y, 1.);
+  EXPECT_NEAR(rrect->size.width, expected->size.width, 1.);
+  EXPECT_NEAR(rrect->size.height, expected->size.height, 1.);
+}
+
+TEST(TestSuite, integral_camshift_ball_rose)
+{
+  integralCamShift("./data/models/ball-rose",
+		   "./data/frames/ball-rose-frame", false);
+}
+
+TEST(TestSuite, integral_camshift_second_order_door)
+{
+  integralCamShift("./data/models/door", "./data/frames/door-frame", true);
+}
+
+// Single pass labeling of several objects, HSV objects are left out.
+TEST(TestSuite, label_engine_balls)
+{
+  cv::Mat image = cv::imread("./data/frames/ball-orange-frame.png");
+
+  Object rose;
+  rose.addView(cv::imread("./data/models/ball-rose.png"));
+  Object orange;
+  orange.lookup_ = BGR_LOOKUP;
+  orange.addView(cv::imread("./data/models/ball-orange.png"));
+
+  std::vector<const Object*> objects;
+  objects.push_back(&rose);
+  objects.push_back(&orange);
+  LabelEngine engine;
+  EXPECT_FALSE(LabelEngine::accepts(rose));
+  EXPECT_TRUE(LabelEngine::accepts(orange));
+  engine.compile(objects);
+  EXPECT_EQ(engine.size(), 2u);
+  engine.label(image);
+  cv::Mat roseLikelihood;
+  engine.likelihood(0, cv::Rect(0, 0, image.cols, image.rows),
+		    roseLikelihood);
+  EXPECT_EQ(0, cv::countNonZero(roseLikelihood));
+
+  Object labeled = orange;
+  boost::optional<cv::RotatedRect> expected = orange.track(image);
+  boost::optional<cv::RotatedRect> rrect = labeled.track(engine, 1);
+  ASSERT_TRUE(expected);
+  ASSERT_TRUE(rrect);
+
+  cv::Rect expectedRect = expected->boundingRect();
+  cv::Rect rect = rrect->boundingRect();
+  EXPECT_GT(double((rect & expectedRect).area())
+	    / (rect | expectedRect).area(), 0.5);
+}
+
+// Naive tracking of a saturated object must find the same blob.
+TEST(TestSuite, naive_ball_orange)
+{
+  cv::Mat view = cv::imread("./data/models/ball-orange.png");
+  cv::Mat image = cv::imread("./data/frames/ball-orange-frame.png");
+
+  Object camshift;
+  camshift.addView(view);
+  Object naive;
+  naive.algo_ = NAIVE;
+  naive.addView(view);
+  EXPECT_EQ(naive.hueHistogram_.size(), 1u);
+
+  boost::optional<cv::RotatedRect> expected = camshift.track(image);
+  boost::optional<cv::RotatedRect> rrect = naive.track(image);
+  ASSERT_TRUE(expected);
+  ASSERT_TRUE(rrect);
+
+  cv::Rect expectedRect = expected->boundingRect();
+  cv::Rect rect = rrect->boundingRect();
+  EXPECT_GT(double((rect & expectedRect).area())
+	    / (rect | expectedRect).area(), 0.5);
+}
+
+// Cached models must track as the freshly compiled ones.
+TEST(TestSuite, model_cache_round_trip)
+{
+  cv::Mat image = cv::imread("./data/frames/ball-orange-frame.png");
+
+  std::vector<CachedModel> models(2);
+  models[0].name = "orange";
+  models[0].path = "./data/models/ball-orange.png";
+  models[0].object.anchor_x_ = 0.5;
+  models[0].object.addView(cv::imread(models[0].path));
+  models[1].name = "empty";
+  saveModelCache("./object-test.cache", models);
+
+  std::vector<CachedModel> loaded;
+  ASSERT_TRUE(loadModelCache("./object-test.cache", loaded));
+  ASSERT_EQ(loaded.size(), 2u);
+  EXPECT_EQ(loaded[0].name, "orange");
+  EXPECT_EQ(loaded[0].path, models[0].path);
+  EXPECT_EQ(loaded[0].object.anchor_x_, 0.5);
+  EXPECT_EQ(cv::countNonZero(loaded[0].object.bgrLut_
+			     != models[0].object.bgrLut_), 0);
+  EXPECT_TRUE(loaded[1].object.compiledHistogram_.empty());
+
+  EXPECT_TRUE(modelCacheFresh("./object-test.cache",
+			      std::vector<std::string>(1, models[0].path)));
+
+  Object cached;
+  cached.copyModel(loaded[0].object);
+  boost::optional<cv::RotatedRect> expected = models[0].object.track(image);
+  boost::optional<cv::RotatedRect> rrect = cached.track(image);
+  ASSERT_TRUE(expected);
+  ASSERT_TRUE(rrect);
+  EXPECT_EQ(rrect->center, expected->center);
+}
+
+// A cached model is only used for the image it has been compiled from.
+TEST(TestSuite, model_cache_path_mismatch)
+{
+  std::vector<CachedModel> models(1);
+  models[0].name = "orange";
+  models[0].path = "./data/models/ball-orange.png";
+
+  EXPECT_EQ(&models[0], findCachedModel(models, "orange",
+					"./data/models/ball-orange.png"));
+  EXPECT_EQ(&models[0], findCachedModel(models, "orange",
+					"data/models/../models/ball-orange.png"));
+  EXPECT_FALSE(findCachedModel(models, "orange",
+			       "./data/models/ball-rose.png"));
+  EXPECT_FALSE(findCachedModel(models, "rose",
+			       "./data/models/ball-orange.png"));
+
+  EXPECT_EQ("./data/models/ball-rose.png",
+	    resolveModelPath("./data/models/ball-rose.png"));
+  EXPECT_EQ("/tmp/ball-rose.png", resolveModelPath("file:///tmp/ball-rose.png"));
+}
+
+// Snapshots must not change when objects are added or removed.
+TEST(TestSuite, object_registry_snapshots)
+{
+  ObjectRegistry registry;
+  ObjectRegistry::snapshot_t empty = registry.snapshot();
+  ASSERT_TRUE(empty);
+  EXPECT_TRUE(empty->empty());
+
+  ObjectRegistry::model_t rose(new Object());
+  registry.insert("rose", rose);
+  ObjectRegistry::snapshot_t added = registry.snapshot();
+  EXPECT_TRUE(empty->empty());
+  ASSERT_EQ(added->size(), 1u);
+  EXPECT_EQ(added->find("rose")->second, rose);
+
+  EXPECT_TRUE(registry.erase("rose"));
+  EXPECT_FALSE(registry.erase("rose"));
+  EXPECT_EQ(added->size(), 1u);
+  EXPECT_TRUE(registry.snapshot()->empty());
+}
+
+// Only the last posted value is delivered, and only once.
+TEST(TestSuite, mailbox_last_value)
+{
+  Mailbox<cv::Rect> hints;
+  cv::Rect hint;
+  EXPECT_FALSE(hints.take(hint));
+  hints.post(cv::Rect(1, 2, 3, 4));
+  hints.post(cv::Rect(5, 6, 7, 8));
+  ASSERT_TRUE(hints.take(hint));
+  EXPECT_EQ(hint, cv::Rect(5, 6, 7, 8));
+  EXPECT_FALSE(hints.take(hint));
+}
+
+// Frames posted while the worker is busy replace each other.
+namespace
+{
+  struct Gate
+  {
+    Gate() : mutex(), changed(), started(false), open(false) {}
+    boost::mutex mutex;
+    boost::condition_variable changed;
+    bool started;
+    bool open;
+  };
+
+  void blockFrame(Gate* gate)
+  {
+    boost::unique_lock<boost::mutex> lock(gate->mutex);
+    gate->started = true;
+    gate->changed.notify_all();
+    while (!gate->open)
+      gate->changed.wait(lock);
+  }
+
+  void recordFrame(int* last, int frame)
+  {
+    *last = frame;
+  }
+} // end of anonymous namespace.
+
+TEST(TestSuite, frame_worker_latest_frame)
+{
+  Gate gate;
+  int last = 0;
+  FrameWorker worker;
+  worker.post(boost::bind(blockFrame, &gate));
+  {
+    boost::unique_lock<boost::mutex> lock(gate.mutex);
+    while (!gate.started)
+      gate.changed.wait(lock);
+  }
+  for (int frame = 1; frame <= 3; ++frame)
+    worker.post(boost::bind(recordFrame, &last, frame));
+  {
+    boost::unique_lock<boost::mutex> lock(gate.mutex);
+    gate.open = true;
+  }
+  gate.changed.notify_all();
+  for (int i = 0; i < 1000 && worker.processed() < 2; ++i)
+    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+
+  EXPECT_EQ(2u, worker.processed());
+  EXPECT_EQ(2u, worker.dropped());
+  EXPECT_EQ(0u, worker.failed());
+  EXPECT_EQ(3, last);
+}
+
+// Pipelined items keep their order, failed ones are dropped.
+namespace
+{
+  typedef boost::shared_ptr<std::vector<int> > stages_t;
+
+  void recordStage(int stage, stages_t& item)
+  {
+    if (stage == 1 && item->front() == 3)
+      throw std::runtime_error("stage failure");
+    item->push_back(stage);
+  }
+
+  void collectItem(std::vector<int>* output, stages_t& item)
+  {
+    EXPECT_EQ(3u, item->size());
+    output->push_back(item->front());
+  }
+} // end of anonymous namespace.
+
+TEST(TestSuite, pipeline_order)
+{
+  std::vector<int> output;
+  std::vector<Pipeline<stages_t>::stage_t> stages;
+  stages.push_back(boost::bind(recordStage, 0, _1));
+  stages.push_back(boost::bind(recordStage, 1, _1));
+  stages.push_back(boost::bind(collectItem, &output, _1));
+  Pipeline<stages_t> pipeline(stages, 1);
+  for (int i = 0; i < 10; ++i)
+    pipeline.push(stages_t(new std::vector<int>(1, i)));
+  pipeline.flush();
+
+  EXPECT_EQ(9u, pipeline.processed());
+  EXPECT_EQ(1u, pipeline.failed());
+  ASSERT_EQ(9u, output.size());
+  for (unsigned i = 0; i < output.size(); ++i)
+    EXPECT_EQ(int(i < 3 ? i : i + 1), output[i]);
+}
+
+// Once sized on the first frame, tracking must not grow its scratch
+// buffers anymore, with either CamShift. Only the Workspace buffers
+// are counted, not the OpenCV temporaries, see
+// Object::workspaceAllocations.
+void steadyStateWorkspaceReuse(bool integral)
+{
+  cv::Mat image = cv::imread("./data/frames/ball-orange-frame.png");
+
+  Object object;
+  object.roiGating_ = true;
+  object.integralCamShift_ = integral;
+  object.addView(cv::imread("./data/models/ball-orange.png"));
+
+  ASSERT_TRUE(object.track(image));
+  std::size_t allocations = object.workspaceAllocations();
+  EXPECT_GT(allocations, 0u);
+  for (int i = 0; i < 10; ++i)
+    object.track(image);
+  EXPECT_EQ(object.workspaceAllocations(), allocations);
+}
+
+TEST(TestSuite, steady_state_workspace_reuse)
+{
+  steadyStateWorkspaceReuse(false);
+  steadyStateWorkspaceReuse(true);
+}
+
+// Row kernel against the pinhole formula, invalid pixels are skipped.
+TEST(TestSuite, reprojector_rays)
+{
+  const float fT = 50.f;
+  cv::Mat disparity(48, 64, CV_32FC1);
+  for (int v = 0; v < disparity.rows; ++v)
+    for (int u = 0; u < disparity.cols; ++u)
+      disparity.at<float>(v, u) = float((u + v) % 70);
+  disparity.at<float>(20, 10) = std::numeric_limits<float>::quiet_NaN();
+
+  Reprojector reprojector;
+  EXPECT_TRUE(reprojector.setCamera(50., 40., 32., 24., 64, 48));
+  EXPECT_FALSE(reprojector.setCamera(50., 40., 32., 24., 64, 48));
+  reprojector.setDisparity(fT, 1.f, 64.f);
+
+  cv::Rect rect(5, 10, 37, 21);
+  std::vector<cv::Point3f> points;
+  std::vector<int> pixels;
+  reprojector.project(disparity, rect, points, &pixels);
+
+  std::size_t count = 0;
+  for (int v = rect.y; v < rect.y + rect.height; ++v)
+    for (int u = rect.x; u < rect.x + rect.width; ++u)
+      {
+	float d = disparity.at<float>(v, u);
+	if (!(d >= 1.f && d <= 64.f))
+	  continue;
+	ASSERT_LT(count, points.size());
+	float z = fT / d;
+	EXPECT_EQ((v - rect.y) * rect.width + u - rect.x, pixels[count]);
+	EXPECT_NEAR(z, points[count].z, 1e-4);
+	EXPECT_NEAR((u - 32.) / 50. * z, points[count].x, 1e-4);
+	EXPECT_NEAR((v - 24.) / 40. * z, points[count].y, 1e-4);
+	++count;
+      }
+  EXPECT_EQ(count, points.size());
+}
+
+// Background and mismatch points are rejected around the blob depth.
+TEST(TestSuite, depth_filter_outliers)
+{
+  std::vector<cv::Point3f> blob;
+  for (int i = 0; i < 200; ++i)
+    blob.push_back(cv::Point3f(0.f, 0.f, 1.f + 0.001f * (i % 20)));
+  for (int i = 0; i < 30; ++i)
+    blob.push_back(cv::Point3f(0.f, 0.f, 3.f + 0.01f * i));
+  blob.push_back(cv::Point3f(0.f, 0.f, 0.2f));
+
+  depth_filter_t methods[] = {MAD_FILTER, HISTOGRAM_FILTER};
+  for (unsigned i = 0; i < 2; ++i)
+    {
+      DepthFilter filter;
+      filter.method_ = methods[i];
+      std::vector<cv::Point3f> points(blob);
+      EXPECT_EQ(200u, filter.filter(points));
+      ASSERT_EQ(200u, points.size());
+      for (unsigned j = 0; j < points.size(); ++j)
+	{
+	  EXPECT_LE(1.f, points[j].z);
+	  EXPECT_GE(1.019f, points[j].z);
+	}
+    }
+}
+
+// Streaming statistics honor the configured filter.
+TEST(TestSuite, blob_statistics_outliers)
+{
+  DepthFilter filter;
+  filter.method_ = HISTOGRAM_FILTER;
+  BlobStatistics statistics;
+  statistics.reset();
+  EXPECT_FALSE(statistics.compute(filter));
+  for (int i = 0; i < 200; ++i)
+    statistics.add(0.01f * i, 0.f, 1.f + 0.001f * (i % 20));
+  for (int i = 0; i < 30; ++i)
+    statistics.add(5.f, 5.f, 3.f + 0.01f * i);
+  statistics.add(0.f, 0.f, 0.2f);
+
+  ASSERT_TRUE(statistics.compute(filter));
+  EXPECT_EQ(231u, statistics.points());
+  EXPECT_EQ(200u, statistics.inliers_);
+  EXPECT_NEAR(0.995, statistics.centroid_.x, 1e-4);
+  EXPECT_NEAR(0., statistics.centroid_.y, 1e-4);
+  EXPECT_NEAR(1.0095, statistics.centroid_.z, 1e-4);
+  EXPECT_NEAR(1., statistics.min_.z, 1e-6);
+  EXPECT_NEAR(1.019, statistics.max_.z, 1e-6);
+
+  // SOR needs the cloud, the histogram filter is used instead.
+  filter.method_ = STATISTICAL_FILTER;
+  ASSERT_TRUE(statistics.compute(filter));
+  EXPECT_EQ(200u, statistics.inliers_);
+
+  // Only the bins added to are cleared.
+  statistics.reset();
+  EXPECT_FALSE(statistics.compute(filter));
+  statistics.add(0.f, 0.f, 2.f);
+  ASSERT_TRUE(statistics.compute(filter));
+  EXPECT_EQ(1u, statistics.inliers_);
+  EXPECT_NEAR(2., statistics.centroid_.z, 1e-6);
+}
+
+// Streaming statistics and filtered clouds give the same results, no
+// point lying within a bin of the interval bounds.
+TEST(TestSuite, blob_statistics_match_cloud)
+{
+  // Blob at 1 m in front of a background at 2.5 m, with mismatches.
+  const float fT = 50.f;
+  cv::Mat disparity(48, 64, CV_32FC1);
+  for (int v = 0; v < disparity.rows; ++v)
+    for (int u = 0; u < disparity.cols; ++u)
+      disparity.at<float>(v, u) = (u - 32) * (u - 32) + (v - 24) * (v - 24) < 100
+	? 50.f - 0.05f * ((u + v) % 7) : 20.f + 0.1f * (u % 3);
+  for (int v = 0; v < disparity.rows; v += 5)
+    disparity.at<float>(v, (7 * v) % disparity.cols) = 60.f;
+
+  Reprojector reprojector;
+  reprojector.setCamera(50., 40., 32., 24., 64, 48);
+  reprojector.setDisparity(fT, 1.f, 64.f);
+  const cv::Rect rect(22, 14, 21, 21);
+
+  depth_filter_t methods[] = {MAD_FILTER, HISTOGRAM_FILTER};
+  for (unsigned i = 0; i < 2; ++i)
+    {
+      DepthFilter filter;
+      filter.method_ = methods[i];
+
+      std::vector<cv::Point3f> cloud;
+      reprojector.project(disparity, rect, cloud);
+      const std::size_t points = cloud.size();
+      DepthFilter cloudFilter = filter;
+      cloudFilter.filter(cloud);
+      ASSERT_FALSE(cloud.empty());
+      cv::Point3d sum(0., 0., 0.);
+      cv::Point3f low = cloud[0], high = cloud[0];
+      for (unsigned j = 0; j < cloud.size(); ++j)
+	{
+	  sum += cv::Point3d(cloud[j].x, cloud[j].y, cloud[j].z);
+	  low.x = std::min(low.x, cloud[j].x);
+	  low.y = std::min(low.y, cloud[j].y);
+	  low.z = std::min(low.z, cloud[j].z);
+	  high.x = std::max(high.x, cloud[j].x);
+	  high.y = std::max(high.y, cloud[j].y);
+	  high.z = std::max(high.z, cloud[j].z);
+	}
+
+      BlobStatistics statistics;
+      statistics.reset();
+      statistics.add(reprojector, disparity, rect);
+      ASSERT_TRUE(statistics.compute(filter));
+      EXPECT_EQ(points, statistics.points());
+      EXPECT_EQ(cloud.size(), statistics.inliers_);
+      EXPECT_NEAR(sum.x / cloud.size(), statistics.centroid_.x, 1e-5);
+      EXPECT_NEAR(sum.y / cloud.size(), statistics.centroid_.y, 1e-5);
+      EXPECT_NEAR(sum.z / cloud.size(), statistics.centroid_.z, 1e-5);
+      EXPECT_EQ(low, statistics.min_);
+      EXPECT_EQ(high, statistics.max_);
+      EXPECT_LT(statistics.max_.z, 1.1f);
+    }
+}
+
+// Ellipse spans match the rasterized ellipse, up to its border.
+TEST(TestSuite, ellipse_mask_spans)
+{
+  const cv::RotatedRect rrect(cv::Point2f(60.5f, 40.f),
+			      cv::Size2f(50.f, 24.f), 30.f);
+  const cv::Rect rect = rrect.boundingRect();
+  EllipseMask mask;
+  mask.set(rrect, rect);
+  EXPECT_EQ(rect, mask.rect());
+
+  cv::Mat drawn = cv::Mat::zeros(rect.size(), CV_8UC1);
+  cv::ellipse(drawn, cv::RotatedRect(rrect.center - cv::Point2f(rect.x, rect.y),
+				     rrect.size, rrect.angle),
+	      cv::Scalar(255), -1, 8);
+  unsigned differences = 0;
+  for (int row = 0; row < rect.height; ++row)
+    for (int column = 0; column < rect.width; ++column)
+      if (mask.contains(row, column) != (drawn.at<unsigned char>(row, column) != 0))
+	++differences;
+  EXPECT_NEAR(CV_PI * 25. * 12., double(mask.area()), 20.);
+  EXPECT_LT(differences, 2 * (rect.width + rect.height));
+
+  mask.set(cv::RotatedRect(rrect.center, cv::Size2f(0.f, 0.f), 0.f), rect);
+  EXPECT_EQ(0u, mask.area());
+}
+
+// Percentiles are nearest rank, over the last window samples of each
+// stage.
+TEST(TestSuite, latency_monitor_percentiles)
+{
+  LatencyMonitor latency(100);
+  latency.stage("old")->add(1.);
+  LatencyStage* track = latency.stage("track");
+  EXPECT_EQ(track, latency.stage("track"));
+  latency.stage("idle");
+  for (unsigned i = 0; i < 200; ++i)
+    track->add(1e-3 * i);
+  {
+    LatencyMonitor::Scope timing(latency.stage("scope"));
+  }
+  {
+    LatencyMonitor::Scope timing(0);
+  }
+
+  hueblob::LatencyStats stats;
+  latency.toMessage(stats);
+  ASSERT_EQ(3u, stats.stages.size());
+  EXPECT_EQ("old", stats.stages[0].stage);
+  EXPECT_EQ(1u, stats.stages[0].count);
+  EXPECT_EQ(1., stats.stages[0].p99);
+  const hueblob::StageLatency& summary = stats.stages[1];
+  EXPECT_EQ("track", summary.stage);
+  EXPECT_EQ(100u, summary.count);
+  EXPECT_NEAR(.149, summary.p50, 1e-9);
+  EXPECT_NEAR(.194, summary.p95, 1e-9);
+  EXPECT_NEAR(.198, summary.p99, 1e-9);
+  EXPECT_NEAR(.199, summary.max, 1e-9);
+  EXPECT_EQ("scope", stats.stages[2].stage);
+  EXPECT_LE(0., stats.stages[2].max);
+}
+
 int main(int argc, char **argv)
 {
   testing::InitGoogleTest(&argc, argv);